@@ -7,20 +7,72 @@
  *
  */
 
+/* POSIX.1-2008 (rwlocks, pwrite, mkstemp, getaddrinfo) even under -std=c11,
+   plus the platform extras the default mode gives, e.g. madvise() hints */
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+#define _DARWIN_C_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
+#include <strings.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <errno.h>
+#include <dirent.h>
 
 /* --------------------------------------------------------------------------
    Constant definitions
    -------------------------------------------------------------------------- */
-#define MAX_BOATS      120
 #define MAX_NAME       128
-#define MONTH_SLIP     12.50
-#define MONTH_LAND     14.00
-#define MONTH_TRAILOR  25.00
-#define MONTH_STORAGE  11.20
+#define BOAT_SLAB_SIZE 1024   /* Boat records carved out of each arena slab */
+#define MIN_CAPACITY   128    /* initial length of the sorted pointer array */
+#define MIN_INDEX_SIZE 256    /* initial slot count of the name hash index */
+#define MAX_THREADS    64     /* upper bound for --threads */
+#define MIN_CHUNK      (1 << 20)  /* smallest CSV slice worth its own thread */
+#define MIN_BILL_SLICE (1 << 16)  /* fewest boat slots worth a billing thread */
+#define OUT_BUF_SIZE   (1 << 20)  /* output staged before each write() */
+#define OUT_MAX_ROW    256        /* room reserved for one formatted row */
+#define MAX_PATH_LEN   4096
+#define MAX_TAG        32         /* trailer tags keep at most MAX_TAG - 1 chars */
+#define STRING_CHUNK_SIZE (1 << 16)  /* name and tag bytes per string pool chunk */
+#define JOURNAL_COMPACT_SIZE (4 << 20)  /* fold the journal into the snapshot past this */
+#define SNAPSHOT_VERSION     1
+#define LINE_BUF_SIZE  (1 << 16)  /* read size for streamed command input */
+#define MAX_LINE       4096       /* longest command line accepted */
+#define MAX_BILL_MONTHS 1200      /* longest catch-up billed in one go */
+#define MAX_SPACE_NUMBER (1 << 20) /* slip/storage numbers indexed directly */
+#define MAX_FUZZY_EDITS 2         /* typos tolerated by the name search */
+#define MAX_SUGGESTIONS 5         /* near names offered for a missed name */
+#define MAX_FIND_ROWS  20         /* matches the (F)ind menu lists */
+#define BENCH_MIN_OPS  1000000    /* operations timed per benchmark line, at least */
+#define MAX_BENCH_SIZES 16
+#define STAT_BUCKETS   256        /* latency buckets: 4 per power of two of ns */
+#define MAX_CLIENTS    256        /* connections runServer serves at once */
+#define SERVER_TICK_MS 500        /* longest poll() wait: signals, autosave */
+#define BALANCE_STRIPES 64        /* payment locks, picked by name hash */
+#define MAX_FLEET_PATHS 256       /* data files and directories on one command line */
+#define LAZY_BLOCK_SIZE (1 << 14)  /* file bytes per sparse index entry of --lazy */
+#define RATE_LENGTHS   101        /* rate tiers for 0..100 ft; longer boats use 100 */
+#define JOURNAL_MAX_PAYLOAD 4096  /* largest journal record body */
+#define MONTH_SLIP     1250       /* built-in monthly rates, in cents per foot */
+#define MONTH_LAND     1400
+#define MONTH_TRAILOR  2500
+#define MONTH_STORAGE  1120
 
 /* --------------------------------------------------------------------------
    Type definitions
@@ -43,48 +95,519 @@ typedef enum {
  * depending on the LocationType:
  *   - SLIP     => slipNumber   (int)
  *   - LAND     => bayLetter    (char)
- *   - TRAILOR  => licenseTag   (char[32])
+ *   - TRAILOR  => licenseTag   (NUL-terminated, in the arena's string pool)
  *   - STORAGE  => storageNum   (int)
  */
 typedef union {
-    int  slipNumber;       
-    char bayLetter;        
-    char licenseTag[32];   
-    int  storageNum;       
+    int         slipNumber;
+    char        bayLetter;
+    const char *licenseTag;
+    int         storageNum;
 } LocationDetail;
 
+/**
+ * StoredDetail - LocationDetail as snapshots and the journal write it, with
+ * the trailer tag inline (up to MAX_TAG - 1 characters, NUL-padded).
+ */
+typedef union {
+    int32_t slipNumber;
+    char    bayLetter;
+    char    licenseTag[MAX_TAG];
+    int32_t storageNum;
+} StoredDetail;
+
 /**
  * Boat - a struct representing a single boat, including:
- *   - name (up to 127 characters, excluding commas)
- *   - length (0..100)
- *   - locType (SLIP, LAND, TRAILOR, STORAGE)
+ *   - name (up to 127 characters, excluding commas), NUL-terminated in the
+ *     arena's string pool, and nameLen, its length
+ *   - sortKey (first 8 case-folded name bytes packed big-endian, so most
+ *     name comparisons are a single integer compare)
+ *   - locType (SLIP, LAND, TRAILOR, STORAGE), which says how to read detail
  *   - detail (the union above)
- *   - amountOwed (how much this boat owes the marina)
+ *   - id (the record's arena slot; see BoatArena)
+ *   - dirty (a payment changed the balance since the data file was written)
+ * The fields month-end billing touches - length (0..100), locType again, and
+ * amountOwed (how much this boat owes the marina, in cents) - live in the arena's
+ * parallel arrays at index id, read through boatLength() and boatOwed().
+ * At 32 bytes, two records share a cache line.
  */
 typedef struct {
-    char           name[MAX_NAME];
-    int            length;      
-    LocationType   locType;
+    const char    *name;
+    uint64_t       sortKey;
     LocationDetail detail;
-    double         amountOwed;
+    int            id;
+    unsigned char  locType;
+    unsigned char  nameLen;
+    unsigned char  dirty;
 } Boat;
 
 
 /**
- * BoatManager - a struct to hold an array of up to MAX_BOATS pointers to Boat,
- * and a count of how many are in use.  We pass around a pointer to this manager
- * so that there are no global variables.
+ * NameSlot - one slot of the open-addressing name index.  A hash of 0 marks an
+ * empty slot and 1 marks a deleted one (tombstone); live hashes always have
+ * the top bit set so they never collide with either marker.
+ */
+typedef struct {
+    Boat         *boat;
+    unsigned int  hash;
+} NameSlot;
+
+#define SLOT_EMPTY     0u
+#define SLOT_TOMBSTONE 1u
+
+/**
+ * NameIndex - linear-probing hash table mapping a case-folded string of the
+ * Boat record (the name, or for the location index the trailer tag) to the
+ * record, so lookups by that string do not scan the fleet.
+ */
+typedef struct {
+    NameSlot *slots;
+    int       size;      /* power of two, 0 until first insert */
+    int       live;      /* slots holding a boat */
+    int       used;      /* live slots plus tombstones */
+    size_t    keyOffset; /* where the key string's pointer sits in a Boat */
+} NameIndex;
+
+/**
+ * StringPool - append-only storage for the names and trailer tags of a
+ * manager's boats.  Strings are packed NUL-terminated into chunks (normally
+ * STRING_CHUNK_SIZE bytes) that never move, so a Boat holds a plain pointer
+ * and loader threads can fill pools of their own for the arena to adopt.
+ * Released strings are only counted; compactStrings reclaims their bytes
+ * once they outweigh the live ones.
+ */
+typedef struct {
+    char  **chunks;
+    int     numChunks;
+    int     maxChunks;   /* allocated length of chunks[] */
+    size_t  used;        /* bytes taken from the newest chunk */
+    size_t  room;        /* size of the newest chunk */
+    size_t  live;        /* bytes held by current strings */
+    size_t  freed;       /* bytes held by released strings */
+} StringPool;
+
+/**
+ * BoatArena - slab allocator that owns every Boat record in a manager.
+ * Records are handed out from fixed-size slabs of BOAT_SLAB_SIZE boats, so
+ * neighbouring boats share cache lines and there is no per-boat malloc.
+ * Records released by removeBoat are kept on a free list for reuse; the
+ * whole arena is released at once by freeAllBoats.
+ *
+ * Record number i of slab s has id s * BOAT_SLAB_SIZE + i, and its hot
+ * billing fields are stored struct-of-arrays style in length[id],
+ * locType[id] and amountOwed[id].  Slots that hold no boat have length 0
+ * and amountOwed 0, so month-end can sweep every slot without checks.
+ */
+typedef struct {
+    Boat **slabs;        /* each slab holds BOAT_SLAB_SIZE records */
+    int    numSlabs;
+    int    maxSlabs;     /* allocated length of slabs[] */
+    int    slabUsed;     /* records handed out from the newest slab */
+    Boat  *freeList;     /* released records, linked through their storage */
+
+    int           *length;      /* maxSlabs * BOAT_SLAB_SIZE slots each */
+    unsigned char *locType;
+    int64_t       *amountOwed;  /* whole cents, so billing is exact */
+    int           *locNext;     /* next id at the same location, -1 = end */
+
+    StringPool     strings;     /* the records' names and trailer tags */
+} BoatArena;
+
+/**
+ * LocationIndex - secondary indexes from a boat's location detail to the
+ * boats there, kept in step with the fleet by every add and remove:
+ *   - slip and storage numbers: direct-mapped arrays indexed by number
+ *   - bays: one bucket per letter 'A'..'Z'
+ *   - trailer tags: a hash table on the tag (case-insensitive)
+ * Array entries and buckets head chains of arena ids linked through
+ * arena.locNext, -1 meaning none.  Numbers outside 0..MAX_SPACE_NUMBER - 1
+ * and bays that are not letters go on one overflow chain per location.
+ */
+typedef struct {
+    int      *slip;      /* slipSize heads */
+    int       slipSize;
+    int      *storage;   /* storageSize heads */
+    int       storageSize;
+    int       bay[26];
+    int       other[4];  /* overflow chains, by LocationType */
+    NameIndex tags;
+} LocationIndex;
+
+/**
+ * RateTable - monthly rate in cents per foot for every LocationType and
+ * boat length, so billing is one lookup with no tier search: a boat of
+ * length n at location l pays perFoot[l][n] * n a month.  Boats longer than
+ * RATE_LENGTHS - 1 feet use the last column.  At 3KB it stays in L1 cache.
+ */
+typedef struct {
+    int64_t perFoot[4][RATE_LENGTHS];
+} RateTable;
+
+/**
+ * RatePeriod - the rates in effect from fromMonth (year * 12 + month - 1)
+ * until the next period.
+ */
+typedef struct {
+    int       fromMonth;
+    RateTable table;
+} RatePeriod;
+
+/**
+ * RateSchedule - the rate changes over time, periods sorted by fromMonth.
+ * Months before the first period are billed at the first period's rates.
+ */
+typedef struct RateSchedule {
+    RatePeriod *periods;
+    int         numPeriods;
+} RateSchedule;
+
+/**
+ * BillingTotals - cents charged by one month-end run, per LocationType.
+ */
+typedef struct {
+    int64_t billed[4];
+    int     owingDelta;   /* change in the number of boats owing money */
+} BillingTotals;
+
+/**
+ * RemittanceResult - what postRemittance made of a bank remittance file.
+ */
+typedef struct {
+    long    posted;       /* payments applied */
+    long    rejected;     /* lines written to the rejects file */
+    int64_t amount;       /* cents posted */
+} RemittanceResult;
+
+/**
+ * FleetTotals - running aggregates over the boats in a manager, updated in
+ * O(1) by every add, remove, payment and month-end so that summaries never
+ * need to scan the fleet.  Amounts are in cents; billed is the revenue
+ * charged by month-end runs since the fleet was loaded.
+ */
+typedef struct {
+    int64_t totalOwed;
+    int     numOwing;       /* boats with a nonzero balance */
+    int     count[4];       /* boats per LocationType */
+    int64_t owed[4];        /* balances per LocationType */
+    int64_t billed[4];      /* month-end charges per LocationType */
+} FleetTotals;
+
+/**
+ * StatOp - the operations whose latency is measured when statistics are on.
+ */
+typedef enum {
+    STAT_LOAD,       /* loadFleet */
+    STAT_SAVE,       /* saveFleet, i.e. how long a save blocks the loop */
+    STAT_LOOKUP,     /* findBoat (and so findBoatIndex) */
+    STAT_PAYMENT,    /* postPayment */
+    STAT_MONTH_END,  /* billRates, behind every month-end command */
+    STAT_OPS
+} StatOp;
+
+/**
+ * LatencyHistogram - call count, failures and a log-linear histogram of
+ * clock_gettime latencies for one StatOp.  Bucket boundaries step by a
+ * quarter of a power of two, so a percentile read from it is within 25%.
+ */
+typedef struct {
+    uint64_t count;
+    uint64_t failed;         /* lookups that missed, refused payments, ... */
+    uint64_t totalNs;
+    uint64_t maxNs;
+    uint64_t buckets[STAT_BUCKETS];
+} LatencyHistogram;
+
+/**
+ * Stats - everything --stats collects.  The manager only points at one while
+ * statistics are on; with the pointer NULL each hook costs one branch.
+ */
+typedef struct Stats {
+    LatencyHistogram ops[STAT_OPS];
+} Stats;
+
+/**
+ * ManagerLocks - what makes a BoatManager safe to share between threads.
+ * lock is taken shared by everything that leaves the sorted array as it is
+ * (lookups, listings, summaries and payments) and exclusively by whatever
+ * adds, removes or bills boats.  A payment, running shared, also holds the
+ * stripe picked by its boat's name hash while it checks and changes the
+ * balance, and totalsLock while it updates the totals and the journal.
+ */
+typedef struct ManagerLocks {
+    pthread_rwlock_t lock;
+    pthread_mutex_t  stripes[BALANCE_STRIPES];
+    pthread_mutex_t  totalsLock;
+} ManagerLocks;
+
+/**
+ * SaveState - how far the manager's data file lags behind it, so that a save
+ * with nothing to write is skipped and a snapshot whose boats only took
+ * payments gets just those records rewritten.  changes counts every
+ * mutation and savedChanges its value at the last save; dirtyBoats counts
+ * the boats whose dirty flag is set.  inPlace says the data file is a
+ * snapshot holding boats[] in order, as identified by fileId (see
+ * snapshotIdentity); adding, removing and month-end clear it.
+ */
+typedef struct {
+    uint64_t changes;       /* updated atomically: payments may overlap */
+    uint64_t savedChanges;
+    long     dirtyBoats;    /* updated atomically */
+    int      inPlace;
+    uint64_t fileId[3];
+} SaveState;
+
+/**
+ * BoatManager - a struct to hold a growable array of pointers to Boat (kept
+ * sorted by name), a count of how many are in use, and the arena that owns
+ * the records.  We pass around a pointer to this manager so that there are no
+ * global variables.
  */
 typedef struct {
-    Boat* boats[MAX_BOATS];
-    int   numBoats; 
+    Boat    **boats;
+    int       numBoats;
+    int       capacity;  /* allocated length of boats[] */
+    BoatArena arena;
+    NameIndex nameIndex; /* same boats, keyed by case-folded name */
+    LocationIndex locations; /* same boats, keyed by location detail */
+    struct Journal *journal;  /* where mutations are logged, NULL = off */
+    const RateSchedule *rates; /* dated billing rates, NULL = MONTH_* */
+    int       billThreads; /* workers for month-end billing */
+    FleetTotals totals;    /* aggregates over boats[] */
+    Stats    *stats;       /* latency counters, NULL = off */
+    ManagerLocks *locks;   /* set while shared by threads, NULL = not */
+    SaveState saved;       /* what the data file is missing */
+    struct LazyFile *lazy; /* unparsed part of the data file, NULL = none */
 } BoatManager;
 
 
+/**
+ * MappedFile - read-only view of a whole file.  Normally an mmap of the file;
+ * if mapping is not possible (e.g. a pipe) the contents are read into a heap
+ * buffer instead, and isMapped tells closeMappedFile which one to undo.
+ */
+typedef struct {
+    const char *data;
+    size_t      size;
+    int         isMapped;
+} MappedFile;
+
+/**
+ * LazyBlock - one entry of a LazyFile's sparse index: the offset of the
+ * first parseable line at or after a multiple of LAZY_BLOCK_SIZE, and that
+ * line's boat name.  The block runs up to the next entry's offset.
+ */
+typedef struct {
+    size_t      offset;
+    const char *name;     /* in LazyFile.names */
+    uint64_t    sortKey;
+    int         loaded;   /* its boats are in the manager */
+} LazyBlock;
+
+/**
+ * LazyFile - a CSV data file opened with --lazy: kept mapped, with only the
+ * sparse block index built up front, so boats are parsed a block at a time
+ * as lookups reach them.  The file must be sorted by name (saveToCSV writes
+ * it that way), so a name can only be in the blocks whose first names
+ * bracket it.
+ */
+typedef struct LazyFile {
+    MappedFile  file;
+    LazyBlock  *blocks;
+    int         numBlocks;
+    int         unloaded;  /* blocks with boats still only in the file */
+    StringPool  names;
+    char        path[MAX_PATH_LEN];
+} LazyFile;
+
+/**
+ * OutBuffer - output staging area written straight to a file descriptor.
+ * Rows are formatted into buf with the out*() helpers (no stdio, no format
+ * strings) and handed to write() only when the buffer fills or on outFlush,
+ * so a typical save is a single system call.
+ */
+typedef struct {
+    int     fd;       /* -1: keep everything in memory */
+    char   *buf;
+    size_t  len;
+    size_t  cap;      /* allocated size of buf */
+    int     failed;   /* set once any write() fails */
+} OutBuffer;
+
+/**
+ * FsyncMode - how hard a durable save pushes data to stable storage:
+ *   - FSYNC_ALWAYS   => fsync the file and its directory on every save
+ *   - FSYNC_PERIODIC => fsync at most once every fsyncInterval seconds
+ *   - FSYNC_NEVER    => leave write-back to the operating system
+ */
+typedef enum {
+    FSYNC_ALWAYS,
+    FSYNC_PERIODIC,
+    FSYNC_NEVER
+} FsyncMode;
+
+/**
+ * SavePolicy - durability settings for atomic saves and the main loop's
+ * autosave, plus the timestamps needed to apply them.
+ */
+typedef struct {
+    FsyncMode fsyncMode;
+    int       fsyncInterval;     /* seconds, for FSYNC_PERIODIC */
+    int       autosaveInterval;  /* seconds between autosaves, 0 = off */
+    time_t    lastFsync;
+    time_t    lastSave;
+} SavePolicy;
+
+/**
+ * DataFormat - on-disk representation of the data file:
+ *   - FORMAT_CSV    => one text line per boat (import/export format)
+ *   - FORMAT_BINARY => header + fixed-size records + string table, loaded by
+ *                      mapping the file (selected by the ".mbs" extension)
+ */
+typedef enum {
+    FORMAT_CSV,
+    FORMAT_BINARY
+} DataFormat;
+
+/**
+ * Fleet - many marinas run as one partitioned fleet: each marina's data file
+ * is loaded into a BoatManager shard of its own, and the shards' arrays are
+ * never joined.  Loading, month-end and saving run the shards on up to
+ * workers threads at once; fleet-wide listings merge the shards' sorted
+ * arrays.  A marina is named by its file name, less directory and extension.
+ */
+typedef struct {
+    BoatManager *shards;
+    char       **files;     /* data file of each shard */
+    DataFormat  *formats;
+    int          numShards;
+    int          capacity;  /* allocated length of the arrays */
+    int          workers;
+} Fleet;
+
+/**
+ * SnapshotHeader / SnapshotRecord - layout of a binary snapshot, in native
+ * byte order:
+ *     SnapshotHeader | numRecords x SnapshotRecord | string table
+ * Records are stored in name order, so loading needs no sort.  Each name is
+ * NUL-terminated in the string table at nameOffset.  recordSize must match
+ * sizeof(SnapshotRecord), which guards against layout changes between builds.
+ */
+typedef struct {
+    char     magic[8];      /* "MBSNAP" followed by two NULs */
+    uint32_t version;       /* SNAPSHOT_VERSION */
+    uint32_t recordSize;
+    uint64_t numRecords;
+    uint64_t stringsSize;
+} SnapshotHeader;
+
+typedef struct {
+    uint32_t       nameOffset;
+    uint32_t       nameLength;
+    int32_t        length;
+    uint32_t       locType;
+    StoredDetail   detail;
+    int64_t        amountOwed;  /* cents */
+} SnapshotRecord;
+
+/**
+ * JournalOp - kind of change recorded in the transaction journal.
+ */
+typedef enum {
+    JOURNAL_ADD = 1,   /* payload: full boat record */
+    JOURNAL_REMOVE,    /* payload: boat name */
+    JOURNAL_PAYMENT,   /* payload: boat name, amount */
+    JOURNAL_MONTH      /* payload: the RateTable billed */
+} JournalOp;
+
+/**
+ * Journal - append-only write-ahead log kept next to the data file as
+ * "<file>.journal".  It starts with a header naming the CSV snapshot it
+ * applies to (inode, size, mtime), followed by records of the form
+ *     u32 payload length | u8 op | payload | u32 checksum
+ * in native byte order.  Startup loads the snapshot and replays the records;
+ * compaction writes a new snapshot and starts an empty journal for it.
+ */
+typedef struct Journal {
+    int         fd;        /* -1 while closed */
+    char        path[MAX_PATH_LEN];
+    off_t       size;      /* bytes written, header included */
+    SavePolicy *policy;    /* fsync cadence for appended records */
+} Journal;
+
+/**
+ * LineReader - splits a file descriptor into lines using large read()s, so
+ * a command stream costs a handful of system calls instead of one per line.
+ */
+typedef struct {
+    int    fd;
+    char  *buf;
+    size_t start, end;    /* unconsumed bytes are buf[start, end) */
+    int    eof;
+} LineReader;
+
+/**
+ * CsvRow - one parsed data line, with the text fields left in place as
+ * (pointer, length) slices of the source buffer.
+ */
+typedef struct {
+    const char *name;    int nameLen;
+    const char *loc;     int locLen;
+    const char *detail;  int detailLen;
+    int         length;
+    int64_t     owed;    /* cents */
+} CsvRow;
+
+/**
+ * InventoryFilter - which boats an inventory listing shows, in name order:
+ * those matching every set condition, after skipping offset matches and
+ * stopping after limit of them.
+ */
+typedef struct {
+    int         locType;       /* LocationType, or -1 for any */
+    int         hasMinOwed;    /* only boats owing more than minOwed */
+    int64_t     minOwed;
+    char        prefix[MAX_NAME];  /* case-insensitive name prefix, "" = any */
+    long        offset;
+    long        limit;         /* -1 = no limit */
+} InventoryFilter;
+
+/**
+ * ReceivablesQuery - what a receivables report lists: with top set, the top
+ * boats by balance, largest first; otherwise every boat owing more than
+ * minOwed, grouped by location and in name order within each.
+ */
+typedef struct {
+    int         top;           /* how many of the largest balances, 0 = all */
+    int         locType;       /* LocationType, or -1 for any */
+    int64_t     minOwed;       /* only boats owing more than this, cents */
+} ReceivablesQuery;
+
+/* One boat's balance, read once, as ranked by the top-K heap */
+typedef struct {
+    int64_t     owed;
+    int         idx;           /* position in boats[] */
+} OwedEntry;
+
+
 /* --------------------------------------------------------------------------
    Function Prototypes
    -------------------------------------------------------------------------- */
 
+/**
+ * initBoatManager
+ *    Put a manager into the empty state (no boats, no memory allocated).
+ */
+void initBoatManager(BoatManager *manager);
+
+/**
+ * initManagerLocks / destroyManagerLocks
+ *    Set up or tear down the locks of a manager shared between threads
+ *    (point manager->locks at them in between).  initManagerLocks returns
+ *    0 on success, -1 on failure.
+ */
+int  initManagerLocks(ManagerLocks *locks);
+void destroyManagerLocks(ManagerLocks *locks);
+
 /**
  * parseLocationType
  *    Convert a location-type string (e.g. "slip", "land", "trailor", "storage")
@@ -112,31 +635,264 @@ const char* locationTypeString(LocationType t);
  */
 void loadFromCSV(BoatManager *manager, const char *filename);
 
+/**
+ * openMappedFile / closeMappedFile
+ *    Map a whole file read-only (falling back to reading it into memory).
+ *    openMappedFile returns 0 on success, -1 if the file cannot be opened.
+ *    An empty file succeeds with size 0 and data NULL.
+ */
+int  openMappedFile(MappedFile *mf, const char *filename);
+void closeMappedFile(MappedFile *mf);
+
+/**
+ * parseCsvRow
+ *    Tokenize one line "name,length,locType,detail,owed" in [line, end)
+ *    without copying it.  Returns 1 if all five fields parsed, 0 otherwise.
+ */
+int parseCsvRow(const char *line, const char *end, CsvRow *row);
+
+/**
+ * createBoatFromRow
+ *    createBoat() for a parsed CsvRow (copies the name and detail slices).
+ */
+Boat* createBoatFromRow(BoatManager *manager, const CsvRow *row);
+
+/**
+ * loadFromCSVParallel
+ *    Same result as loadFromCSV, but the mapped file is split at line
+ *    boundaries into one chunk per thread.  Each thread parses its chunk into
+ *    a private buffer and sorts it; the sorted runs are then merged pairwise in
+ *    parallel.  numThreads <= 1 (or a small file) uses the serial loader.
+ */
+void loadFromCSVParallel(BoatManager *manager, const char *filename, int numThreads);
+
+/**
+ * openLazyCSV
+ *    Open a CSV data file without loading it: map it and index the first
+ *    name of every LAZY_BLOCK_SIZE bytes, so startup reads only those pages.
+ *    findBoat then parses just the blocks that can hold a name, and
+ *    loadRemainingBoats brings in the rest for whatever needs the whole
+ *    fleet.  Returns 0 if the manager now reads the file that way, or -1 if
+ *    it cannot (e.g. the file is not sorted by name, or manager->locks is
+ *    set: those lookups change the fleet); load it normally then.
+ */
+int  openLazyCSV(BoatManager *manager, const char *filename);
+
+/**
+ * loadRemainingBoats
+ *    Parse every block of a lazily opened file that is not loaded yet and
+ *    drop the sparse index, leaving an ordinary fully loaded manager.  Does
+ *    nothing if the manager is not lazy.
+ */
+void loadRemainingBoats(BoatManager *manager);
+
+/**
+ * outOpen / outFlush / outClose
+ *    Manage an OutBuffer on file descriptor fd.  outFlush writes whatever is
+ *    buffered; outClose flushes and frees the buffer (it does not close fd).
+ *    outOpen returns 0 on success; outClose returns 0 if every write succeeded.
+ *    With fd -1 nothing is written: "flushing" grows the buffer instead, so
+ *    the caller can send out->buf at its own pace.
+ */
+int  outOpen(OutBuffer *out, int fd);
+void outFlush(OutBuffer *out);
+int  outClose(OutBuffer *out);
+
 /**
  * saveToCSV
  *    Save boat data from manager into a CSV file (overwrites existing file).
  */
 void saveToCSV(const BoatManager *manager, const char *filename);
 
+/**
+ * saveToCSVAtomic
+ *    Crash-safe save: write the CSV to a temporary file next to filename,
+ *    fsync it as the policy requires, then rename() it over the original, so
+ *    the file on disk is always either the old or the new fleet.  Returns 0 on
+ *    success, -1 on failure (the original file is left untouched).
+ */
+int saveToCSVAtomic(const BoatManager *manager, const char *filename,
+                    SavePolicy *policy);
+
+/**
+ * dataFormatForFile
+ *    Pick the format implied by a file name (".mbs" => FORMAT_BINARY).
+ */
+DataFormat dataFormatForFile(const char *filename);
+
+/**
+ * loadSnapshot
+ *    Load a binary snapshot into an empty manager by mapping the file and
+ *    copying the fixed-size records; there is no text parsing or sorting.
+ *    A missing file leaves the manager empty; returns -1 if the file exists
+ *    but is not a valid snapshot.
+ */
+int loadSnapshot(BoatManager *manager, const char *filename);
+
+/**
+ * saveSnapshotAtomic
+ *    Crash-safe save of the fleet as a binary snapshot (same temp file +
+ *    rename scheme as saveToCSVAtomic).  Returns 0 on success, -1 on failure.
+ */
+int saveSnapshotAtomic(const BoatManager *manager, const char *filename,
+                       SavePolicy *policy);
+
+/**
+ * loadFleet / saveFleet
+ *    Load or durably save filename in the given format.  loadFleet uses
+ *    numThreads loader threads for CSV input.  Both return 0 on success and
+ *    -1 on failure.
+ */
+int  loadFleet(BoatManager *manager, const char *filename, DataFormat format,
+               int numThreads);
+int  saveFleet(const BoatManager *manager, const char *filename,
+               DataFormat format, SavePolicy *policy);
+
+/**
+ * saveChanges
+ *    Bring filename up to date with the manager: nothing is written if
+ *    nothing changed since it was loaded or saved, and a snapshot in which
+ *    only some balances changed has just those records patched; anything
+ *    else is a full saveFleet.  Returns 0 on success, -1 on failure.
+ */
+int  saveChanges(BoatManager *manager, const char *filename,
+                 DataFormat format, SavePolicy *policy);
+
+/**
+ * replayJournal
+ *    Apply the records of filename's journal to a manager freshly loaded from
+ *    filename.  A journal written against an older snapshot is ignored, and a
+ *    torn record at the tail ends the replay.  Returns the length of the valid
+ *    prefix of the journal (0 if there is nothing usable).
+ */
+off_t replayJournal(BoatManager *manager, const char *filename);
+
+/**
+ * journalOpen
+ *    Open filename's journal for appending.  validSize is what replayJournal
+ *    returned: a torn tail beyond it is cut off, and 0 starts a fresh journal
+ *    for the current snapshot.  Returns 0 on success, -1 on failure.
+ */
+int journalOpen(Journal *journal, const char *filename, SavePolicy *policy,
+                off_t validSize);
+
+/**
+ * journalClose
+ *    Flush (per the fsync policy) and close the journal.
+ */
+void journalClose(Journal *journal);
+
+/**
+ * compactJournal
+ *    Fold the journal into a new snapshot: save the data file atomically in
+ *    the given format, then replace the journal with an empty one for that
+ *    snapshot.  Returns 0 on success, -1 on failure (the old journal stays
+ *    valid).
+ */
+int compactJournal(BoatManager *manager, const char *filename, DataFormat format,
+                   Journal *journal);
+
 /**
  * printInventory
- *    Print a sorted list (alphabetical by boat name) of all boats in manager.
+ *    Print a sorted list (alphabetical by boat name) of the boats in manager
+ *    that pass filter (all of them if filter is NULL), followed by a blank
+ *    line.  Rows are formatted into one buffer and written straight to
+ *    standard output, not through stdio.
+ */
+void printInventory(const BoatManager *manager, const InventoryFilter *filter);
+
+/**
+ * writeInventory
+ *    Format the inventory rows selected by filter (NULL = every boat) into
+ *    out.  Returns the number of rows written.
+ */
+long writeInventory(const BoatManager *manager, OutBuffer *out,
+                    const InventoryFilter *filter);
+
+/**
+ * parseInventoryFilter
+ *    Fill filter from comma-separated terms, any of
+ *        loc=<locType>  owed><amount>  name=<prefix>  offset=<n>  limit=<n>
+ *    Terms not given match everything.  Returns 0, or -1 if malformed.
+ */
+int parseInventoryFilter(const char *p, const char *end, InventoryFilter *filter);
+
+/**
+ * writeReceivables / printReceivables
+ *    Format the receivables report for query into out, or print it followed
+ *    by a blank line.  A top-K report keeps a bounded min-heap of K entries
+ *    during one pass, O(N log K); the by-location report is one filtered
+ *    pass.  Neither reorders or copies boats[].  writeReceivables returns the
+ *    number of boats listed, or -1 if out of memory.
+ */
+long writeReceivables(const BoatManager *manager, OutBuffer *out,
+                      const ReceivablesQuery *query);
+void printReceivables(const BoatManager *manager, const ReceivablesQuery *query);
+
+/**
+ * parseReceivablesQuery
+ *    Fill query from comma-separated terms, any of
+ *        top=<n>  loc=<locType>  owed><amount>
+ *    Without top= the report covers every boat owing more than the amount
+ *    ($0 if not given), by location.  Returns 0, or -1 if malformed.
+ */
+int parseReceivablesQuery(const char *p, const char *end, ReceivablesQuery *query);
+
+/**
+ * printSummary
+ *    Print the fleet's running totals: boats, balances and month-end revenue
+ *    overall and per location.  Reads the maintained aggregates, no scan.
+ */
+void printSummary(const BoatManager *manager);
+
+/**
+ * printStats
+ *    Print count, failures and mean/p50/p99/max latency of every measured
+ *    operation to fp, or say that statistics are off.
  */
-void printInventory(const BoatManager *manager);
+void printStats(const BoatManager *manager, FILE *fp);
 
 /**
  * addBoat
- *    Prompt the user for CSV-like input, create a new Boat, store in manager,
- *    re-sort by name.
+ *    Prompt the user for CSV-like input, create a new Boat, and insert it into
+ *    manager at its sorted position.
  */
 void addBoat(BoatManager *manager);
 
+/**
+ * addBoatRow
+ *    Create a boat from a parsed CSV row and insert it at its sorted position.
+ *    A slip or storage space holds one boat: if the row's space is taken,
+ *    nothing is added and *occupant (when occupant is not NULL) is set to the
+ *    boat there.  Returns the boat, or NULL if it was not added.
+ */
+Boat* addBoatRow(BoatManager *manager, const CsvRow *row, const Boat **occupant);
+
 /**
  * removeBoat
  *    Prompt for a boat name; if found, remove from manager. Otherwise show error.
  */
 void removeBoat(BoatManager *manager);
 
+/**
+ * removeBoatAt
+ *    Remove the boat at position idx of the sorted array and release it.
+ */
+void removeBoatAt(BoatManager *manager, int idx);
+
+/**
+ * applyPayment
+ *    Subtract an (already validated) payment from a boat's balance.
+ */
+void applyPayment(BoatManager *manager, Boat *b, int64_t payment);
+
+/**
+ * postPayment
+ *    Apply a payment (in cents) unless it exceeds the amount owed.  Returns 0
+ *    if the payment was applied, -1 if it was refused.
+ */
+int postPayment(BoatManager *manager, Boat *b, int64_t payment);
+
 /**
  * acceptPayment
  *    Prompt for boat name and payment amount. Subtract from the boat's owed
@@ -145,58 +901,553 @@ void removeBoat(BoatManager *manager);
 void acceptPayment(BoatManager *manager);
 
 /**
- * monthlyUpdate
- *    Apply monthly charges to each boat's owed amount, depending on location.
+ * executeCommand
+ *    Apply one non-interactive command line and append a one-line result
+ *    ("OK" or "ERR <reason>", preceded by tag and a space if tag > 0) to out.
+ *    Commands (case-insensitive letter):
+ *        A,<name>,<length>,<locType>,<detail>,<owed>    add a boat
+ *        R,<name>                                       remove a boat
+ *        P,<name>,<amount>                              accept a payment
+ *        M                                              month-end charges
+ *        M,<months>                                     several months at once
+ *        M,<YYYY-MM>,<YYYY-MM>                          that range, dated rates
+ *        I[,<filter>]                                   inventory listing
+ *                                        (filter as for parseInventoryFilter)
+ *        S                                              fleet summary
+ *        L,<locType>,<detail>                           boats at a location
+ *        F,<name>                                       names starting so,
+ *                                                       else the nearest
+ *        T                                              latency statistics
+ *        B,<file>[,<rejects>]                           post a remittance file
+ *                                        (rejects default to <file>.rejects)
+ *        O[,<query>]                                    receivables report
+ *                                        (query as for parseReceivablesQuery)
+ *    Month-end answers "OK billed <total> <slip> <land> <trailor> <storage>";
+ *    S answers "OK boats <n> owing <n> owed <total>" followed by
+ *    "<location> <boats> <owed> <billed>" for each location; L and F answer
+ *    "OK <count>" and the names, separated by commas (F lists at most
+ *    MAX_FIND_ROWS); T answers "OK" and, per operation,
+ *    "<op> <count> <failed> <mean> <p50> <p99> <max>" in nanoseconds;
+ *    B answers "OK posted <count> total <amount> rejected <count>"; I and O
+ *    write their rows and a blank line ahead of the "OK".  Blank lines and
+ *    lines starting with '#' are ignored and produce no result.  Returns 0
+ *    for OK, 1 for an error result, -1 if ignored.
+ *    With manager->locks set, A, R and M hold the fleet lock exclusively and
+ *    every other command holds it shared; a lazily opened manager is never
+ *    shared, as its lookups and listings load boats.
  */
-void monthlyUpdate(BoatManager *manager);
+int executeCommand(BoatManager *manager, const char *line, size_t len,
+                   OutBuffer *out, long tag);
 
 /**
- * findBoatIndex
- *    Return the index of the boat (case-insensitive name match), or -1 if not found.
+ * runBatch
+ *    Read commands from filename ("-" for standard input) and apply them
+ *    with executeCommand, writing "<line number> <result>" for each to
+ *    standard output.  Returns the number of commands that failed, or -1 if
+ *    the input could not be opened.
  */
-int findBoatIndex(const BoatManager *manager, const char *name);
+int runBatch(BoatManager *manager, const char *filename);
 
 /**
- * createBoat
- *    Allocate a new Boat struct, initialize from given data, and return pointer.
+ * postRemittance
+ *    Post every payment in a bank remittance file of "<boat name>,<amount>"
+ *    lines in one pass: the lines are sorted by name and merge-joined
+ *    against the fleet, and each is applied with postPayment.  Lines naming
+ *    no boat, paying more than is owed, or malformed go to rejectsFile as
+ *    "<original line>,<reason>", in file order; blank lines and lines
+ *    starting with '#' are skipped.  Returns 0, or -1 if the remittance file
+ *    could not be read or the rejects file could not be written.
  */
-Boat* createBoat(const char *name, int length, LocationType locType,
-                 const char *detailStr, double owed);
+int postRemittance(BoatManager *manager, const char *filename,
+                   const char *rejectsFile, RemittanceResult *result);
 
 /**
- * freeAllBoats
- *    Helper that frees all boats in manager, then sets count to zero.
+ * importRemittance
+ *    Prompt for a remittance file, post it with postRemittance (rejects to
+ *    "<file>.rejects") and report what was posted.
  */
-void freeAllBoats(BoatManager *manager);
+void importRemittance(BoatManager *manager);
 
 /**
- * sortBoatsByName
- *    Sort the array of boat pointers in manager by boat name (case-insensitive).
- *    Uses qsort().
+ * runServer
+ *    Serve manager to clients on address - a Unix socket path (anything
+ *    containing '/') or [host:]port for TCP, loopback unless a host is
+ *    given - with one poll() loop in this thread.  Each request line is an
+ *    executeCommand line (Q closes the connection) and is answered, in
+ *    order, by its result line; I sends its rows first.  Listings run on
+ *    reader threads under manager->locks, so other clients' payments and
+ *    lookups are not held up behind a long one; an add, remove or bill
+ *    that arrives meanwhile is held back, with its client's later
+ *    requests, until the running listings end, and new listings wait for
+ *    it.  Autosaves per policy and returns 0 on SIGINT, SIGTERM or SIGHUP,
+ *    leaving the final save to the caller, or -1 if it could not listen.
  */
-void sortBoatsByName(BoatManager *manager);
+int runServer(BoatManager *manager, const char *address, const char *dataFile,
+              DataFormat format, SavePolicy *policy);
 
-/* --------------------------------------------------------------------------
-   Implementation
-   -------------------------------------------------------------------------- */
+/**
+ * initFleet
+ *    Set up an empty fleet whose shard operations use up to workers threads.
+ */
+void initFleet(Fleet *fleet, int workers);
 
-LocationType parseLocationType(const char *locStr)
-{
-    /* Convert to lower case to compare more easily */
-    char lower[32];
-    int i;
-    for (i = 0; locStr[i] && i < 31; i++) {
-        lower[i] = (char)tolower((unsigned char)locStr[i]);
-    }
-    lower[i] = '\0';
+/**
+ * addFleetPath
+ *    Add a shard for the data file at path, or one for each .csv and .mbs
+ *    file (in name order) if path is a directory.  The format is forceFormat
+ *    if that is not -1, else decided from each file's extension.  Nothing is
+ *    loaded yet.  Returns 0, or -1 on error.
+ */
+int addFleetPath(Fleet *fleet, const char *path, int forceFormat);
 
-    if (strcmp(lower, "slip") == 0)       return SLIP;
-    if (strcmp(lower, "land") == 0)       return LAND;
-    if (strcmp(lower, "trailor") == 0)    return TRAILOR;
-    if (strcmp(lower, "storage") == 0)    return STORAGE;
+/**
+ * loadFleetShards
+ *    Load every shard's data file and replay its journal, shards in
+ *    parallel.  Returns 0, or -1 if any file could not be read.
+ */
+int loadFleetShards(Fleet *fleet);
 
-    /* Default/fallback if unrecognized input */
-    return SLIP;
+/**
+ * saveFleetShards
+ *    saveFleet every shard to its own file, shards in parallel, each with a
+ *    copy of policy.
+ */
+void saveFleetShards(Fleet *fleet, const SavePolicy *policy);
+
+/**
+ * freeFleet
+ *    Free every shard and the fleet's arrays, leaving an empty fleet.
+ */
+void freeFleet(Fleet *fleet);
+
+/**
+ * writeFleetInventory
+ *    writeInventory over the whole fleet: the shards' boats in one name
+ *    order, by a k-way merge of their sorted arrays.  Returns the number of
+ *    rows written, or -1 if out of memory.
+ */
+long writeFleetInventory(const Fleet *fleet, OutBuffer *out,
+                         const InventoryFilter *filter);
+
+/**
+ * executeFleetCommand
+ *    executeCommand for a fleet.  "@<marina>,<command>" runs any command on
+ *    that marina's shard.  Otherwise P and R go to the first marina with
+ *    the boat, M bills every shard in parallel and answers the sums, S
+ *    answers the fleet's totals, I lists the whole fleet in name order and
+ *    T the shared statistics; other commands need a marina.
+ */
+int executeFleetCommand(Fleet *fleet, const char *line, size_t len,
+                        OutBuffer *out, long tag);
+
+/**
+ * runFleetBatch
+ *    runBatch for a fleet, with executeFleetCommand.
+ */
+int runFleetBatch(Fleet *fleet, const char *filename);
+
+/**
+ * generateFleet
+ *    Write count synthetic boats to filename as CSV, the same file for the
+ *    same seed: two-word names with a hull number, 10..100 ft, all four
+ *    location types (no slip or storage number used twice), and balances
+ *    skewed the way receivables are - most boats owe nothing or a little, a
+ *    few owe a lot.  Returns 0 on success, -1 on failure.
+ */
+int generateFleet(const char *filename, long count, uint64_t seed);
+
+/**
+ * runBenchmark
+ *    For each fleet size, generate a fleet into a scratch file and time
+ *    loadFromCSV, sortBoatsByName, findBoatIndex, monthlyUpdate (with
+ *    'threads' workers), writeInventory and saveToCSV on it.  Writes CSV to
+ *    standard output, one line per operation and size:
+ *        op,rows,ops,seconds,ns_per_op,mb_per_s
+ *    where mb_per_s is 0 for operations that do not stream data.  Returns 0,
+ *    or -1 if the scratch files could not be written.
+ */
+int runBenchmark(const long *sizes, int numSizes, int threads);
+
+/**
+ * monthlyUpdate
+ *    Apply monthly charges to each boat's owed amount, depending on location.
+ */
+void monthlyUpdate(BoatManager *manager);
+
+/**
+ * billMonths
+ *    Catch up months of charges at the rates in effect this month (the
+ *    last period that has started, not one announced for later) in one
+ *    pass over the fleet, storing what was charged in totals (if not
+ *    NULL).  Returns -1 (and bills nothing) unless
+ *    1 <= months <= MAX_BILL_MONTHS.
+ */
+int billMonths(BoatManager *manager, int months, BillingTotals *totals);
+
+/**
+ * billDateRange
+ *    Charge every month from firstMonth to lastMonth inclusive (both
+ *    year * 12 + month - 1), each at the rates in effect that month, in one
+ *    pass over the fleet, storing what was charged in totals (if not NULL).
+ *    Returns -1 (and bills nothing) for an empty or over-long range.
+ */
+int billDateRange(BoatManager *manager, int firstMonth, int lastMonth,
+                  BillingTotals *totals);
+
+/**
+ * billRates
+ *    Add the table's perFoot[locType][length] * length cents to every boat's
+ *    balance.  This is the single kernel behind all of the month-end billing
+ *    above.  The arena is split into slices across manager->billThreads
+ *    workers; each sums its own charges per LocationType, and the per-thread
+ *    sums are added into totals (if not NULL) once all have finished.
+ */
+void billRates(BoatManager *manager, const RateTable *table,
+               BillingTotals *totals);
+
+/**
+ * loadRateSchedule
+ *    Read billing rates from a text file into schedule.  Lines are
+ *        <locType> <dollars per foot>           every length
+ *        <locType> <min>-[<max>] <dollars>      that length tier, in feet
+ *        from <YYYY-MM>                         start a new rate period
+ *    Each period starts as a copy of the one before (the first from the
+ *    built-in MONTH_* rates) and later lines override earlier ones; '#'
+ *    starts a comment.  Returns 0 on success, -1 (after reporting the bad
+ *    line) on error.
+ */
+int loadRateSchedule(RateSchedule *schedule, const char *filename);
+
+/**
+ * freeRateSchedule
+ *    Release the periods of a schedule filled by loadRateSchedule.
+ */
+void freeRateSchedule(RateSchedule *schedule);
+
+/**
+ * findBoat
+ *    Return the boat with a case-insensitive name match via the name index, or
+ *    NULL if not found.  On a lazily opened manager the file blocks that can
+ *    hold the name are parsed first, which adds their boats to the fleet
+ *    (and its indexes and totals) and moves boats found earlier.
+ */
+Boat* findBoat(BoatManager *manager, const char *name);
+
+/**
+ * forEachBoatAt
+ *    Call visit(manager, boat, ctx) for every boat at the given location
+ *    (detail as written in the CSV: "27", "C", "7KZ099"), found through the
+ *    location index.  Returns the number of boats visited.  visit may be
+ *    NULL to just count.
+ */
+int forEachBoatAt(const BoatManager *manager, LocationType locType,
+                  const char *detail,
+                  void (*visit)(const BoatManager *, const Boat *, void *),
+                  void *ctx);
+
+/**
+ * findLocation
+ *    Prompt for a location ("slip 27", "land C", "trailor 7KZ099") and print
+ *    the boats there.
+ */
+void findLocation(const BoatManager *manager);
+
+/**
+ * findBoatIndex
+ *    Return the index of the boat (case-insensitive name match), or -1 if not found.
+ *    Like findBoat, on a lazily opened manager this can load boats first.
+ */
+int findBoatIndex(BoatManager *manager, const char *name);
+
+/**
+ * findBoatsByPrefix
+ *    Binary search the sorted array for the boats whose names start with
+ *    prefix (case-insensitive).  They are contiguous: the first one's
+ *    position goes in *first and the count is returned.
+ */
+int findBoatsByPrefix(const BoatManager *manager, const char *prefix, int *first);
+
+/**
+ * findBoatsFuzzy
+ *    Store in matches the positions of up to maxMatches boats whose names
+ *    are within maxEdits single-letter insertions, deletions or changes of
+ *    name (case-insensitive), nearest first and then in name order.  The
+ *    sorted array is walked as an implicit trie, so only ranges of names
+ *    whose prefix can still come close enough are visited.  Returns how
+ *    many were stored.
+ */
+int findBoatsFuzzy(const BoatManager *manager, const char *name, int maxEdits,
+                   int *matches, int maxMatches);
+
+/**
+ * findByName
+ *    Prompt for part of a name and print the boats whose names start with
+ *    it, or failing that the boats with the nearest names.
+ */
+void findByName(const BoatManager *manager);
+
+/**
+ * createBoat
+ *    Allocate a new Boat record from the manager's arena, initialize from given
+ *    data (name and trailer tag copied into the arena's string pool), and
+ *    return pointer, or NULL if out of memory.  The boat is not yet part of
+ *    the sorted array.
+ */
+Boat* createBoat(BoatManager *manager, const char *name, int length,
+                 LocationType locType, const char *detailStr, int64_t owed);
+
+/**
+ * releaseBoat
+ *    Return a Boat record (already taken out of the sorted array) to the
+ *    manager's arena for reuse.
+ */
+void releaseBoat(BoatManager *manager, Boat *b);
+
+/**
+ * appendBoat
+ *    Append a boat pointer to the manager's array, growing it if needed, and
+ *    register it in the name index.  Returns 0 on success, -1 if memory could
+ *    not be allocated.
+ */
+int appendBoat(BoatManager *manager, Boat *b);
+
+/**
+ * insertBoat
+ *    Insert a boat at its alphabetical position (binary search plus one
+ *    memmove) and register it in the name index, so the array stays sorted
+ *    without a full re-sort.  Returns 0 on success, -1 on allocation failure.
+ */
+int insertBoat(BoatManager *manager, Boat *b);
+
+/**
+ * freeAllBoats
+ *    Helper that releases the whole fleet (every arena slab and the pointer
+ *    array) in one call, leaving the manager empty and reusable.
+ */
+void freeAllBoats(BoatManager *manager);
+
+/**
+ * sortBoatsByName
+ *    Sort the array of boat pointers in manager by boat name (case-insensitive).
+ *    Uses qsort().
+ */
+void sortBoatsByName(BoatManager *manager);
+
+/* --------------------------------------------------------------------------
+   Implementation
+   -------------------------------------------------------------------------- */
+
+void initBoatManager(BoatManager *manager)
+{
+    manager->boats    = NULL;
+    manager->numBoats = 0;
+    manager->capacity = 0;
+
+    manager->arena.slabs    = NULL;
+    manager->arena.numSlabs = 0;
+    manager->arena.maxSlabs = 0;
+    manager->arena.slabUsed = BOAT_SLAB_SIZE;  /* forces a slab on first use */
+    manager->arena.freeList = NULL;
+    manager->arena.length     = NULL;
+    manager->arena.locType    = NULL;
+    manager->arena.amountOwed = NULL;
+    manager->arena.locNext    = NULL;
+    memset(&manager->arena.strings, 0, sizeof(manager->arena.strings));
+
+    manager->nameIndex.slots = NULL;
+    manager->nameIndex.size  = 0;
+    manager->nameIndex.live  = 0;
+    manager->nameIndex.used  = 0;
+    manager->nameIndex.keyOffset = offsetof(Boat, name);
+
+    LocationIndex *loc = &manager->locations;
+    loc->slip    = NULL;
+    loc->slipSize = 0;
+    loc->storage = NULL;
+    loc->storageSize = 0;
+    for (int i = 0; i < 26; i++) loc->bay[i] = -1;
+    for (int i = 0; i < 4; i++) loc->other[i] = -1;
+    loc->tags.slots = NULL;
+    loc->tags.size  = 0;
+    loc->tags.live  = 0;
+    loc->tags.used  = 0;
+    loc->tags.keyOffset = offsetof(Boat, detail.licenseTag);
+
+    manager->journal = NULL;
+    manager->rates   = NULL;
+    manager->billThreads = 1;
+    memset(&manager->totals, 0, sizeof(manager->totals));
+    manager->stats   = NULL;
+    manager->locks   = NULL;
+    memset(&manager->saved, 0, sizeof(manager->saved));
+    manager->lazy    = NULL;
+}
+
+
+int initManagerLocks(ManagerLocks *locks)
+{
+    if (pthread_rwlock_init(&locks->lock, NULL) != 0) return -1;
+    for (int i = 0; i < BALANCE_STRIPES; i++) {
+        pthread_mutex_init(&locks->stripes[i], NULL);
+    }
+    pthread_mutex_init(&locks->totalsLock, NULL);
+    return 0;
+}
+
+
+void destroyManagerLocks(ManagerLocks *locks)
+{
+    pthread_rwlock_destroy(&locks->lock);
+    for (int i = 0; i < BALANCE_STRIPES; i++) {
+        pthread_mutex_destroy(&locks->stripes[i]);
+    }
+    pthread_mutex_destroy(&locks->totalsLock);
+}
+
+
+static void lockFleet(const BoatManager *manager, int exclusive)
+{
+    if (!manager->locks) return;
+    if (exclusive) {
+        pthread_rwlock_wrlock(&manager->locks->lock);
+    } else {
+        pthread_rwlock_rdlock(&manager->locks->lock);
+    }
+}
+
+
+static void unlockFleet(const BoatManager *manager)
+{
+    if (manager->locks) pthread_rwlock_unlock(&manager->locks->lock);
+}
+
+
+static inline uint64_t monotonicNanos(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+
+static inline uint64_t statsStart(const BoatManager *manager)
+{
+    return manager->stats ? monotonicNanos() : 0;
+}
+
+
+static int statBucket(uint64_t ns)
+{
+    /* 0..3 exactly, then four buckets per power of two */
+    if (ns < 4) return (int)ns;
+    int log = 63 - __builtin_clzll(ns);
+    return (log - 1) * 4 + (int)((ns >> (log - 2)) & 3);
+}
+
+
+static uint64_t statBucketTop(int bucket)
+{
+    /* Largest latency that falls in the bucket */
+    if (bucket < 4) return (uint64_t)bucket;
+    int log = bucket / 4 + 1;
+    uint64_t step = (uint64_t)1 << (log - 2);
+    return (uint64_t)(4 + bucket % 4) * step + step - 1;
+}
+
+
+static void statsStop(const BoatManager *manager, StatOp op, uint64_t start,
+                      int failed)
+{
+    if (!manager->stats) return;
+    uint64_t ns = monotonicNanos() - start;
+    LatencyHistogram *h = &manager->stats->ops[op];
+
+    /* Relaxed atomics: a shared manager records from several threads */
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->failed, failed != 0, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->totalNs, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->buckets[statBucket(ns)], 1, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&h->maxNs, __ATOMIC_RELAXED);
+    while (ns > max && !__atomic_compare_exchange_n(&h->maxNs, &max, ns, 1,
+                                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+
+static uint64_t statPercentile(const LatencyHistogram *h, int percent)
+{
+    /* Top of the bucket holding the rank'th fastest call (never above max) */
+    uint64_t rank = (h->count * (uint64_t)percent + 99) / 100, seen = 0;
+    for (int i = 0; i < STAT_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank && seen > 0) {
+            uint64_t top = statBucketTop(i);
+            return top < h->maxNs ? top : h->maxNs;
+        }
+    }
+    return h->maxNs;
+}
+
+
+LocationType parseLocationType(const char *locStr)
+{
+    /* Convert to lower case to compare more easily */
+    char lower[32];
+    int i;
+    for (i = 0; locStr[i] && i < 31; i++) {
+        lower[i] = (char)tolower((unsigned char)locStr[i]);
+    }
+    lower[i] = '\0';
+
+    if (strcmp(lower, "slip") == 0)       return SLIP;
+    if (strcmp(lower, "land") == 0)       return LAND;
+    if (strcmp(lower, "trailor") == 0)    return TRAILOR;
+    if (strcmp(lower, "storage") == 0)    return STORAGE;
+
+    /* Default/fallback if unrecognized input */
+    return SLIP;
+}
+
+
+static int matchLocationType(const char *word, size_t len)
+{
+    /* Strict, case-insensitive match of a location name; -1 if unknown */
+    static const char *const names[4] = { "slip", "land", "trailor", "storage" };
+    for (int loc = 0; loc < 4; loc++) {
+        if (strlen(names[loc]) == len && strncasecmp(word, names[loc], len) == 0) {
+            return loc;
+        }
+    }
+    return -1;
+}
+
+
+static inline unsigned char foldChar(char c)
+{
+    /* ASCII lower-casing without going through the locale tables */
+    unsigned char u = (unsigned char)c;
+    return (u >= 'A' && u <= 'Z') ? (unsigned char)(u | 0x20) : u;
+}
+
+
+static uint64_t makeSortKey(const char *name)
+{
+    /* Pack the first 8 folded bytes big-endian, zero-padded past the end */
+    uint64_t key = 0;
+    for (int i = 0; i < 8; i++) {
+        unsigned char c = *name ? foldChar(*name++) : 0;
+        key = (key << 8) | c;
+    }
+    return key;
+}
+
+
+static int compareKeyedNames(uint64_t ka, const char *a, uint64_t kb, const char *b)
+{
+    if (ka != kb) return ka < kb ? -1 : 1;
+    /* Equal prefixes: if the last key byte is NUL both names ended inside it */
+    if ((ka & 0xff) == 0) return 0;
+    return caseInsensitiveCompare(a + 8, b + 8);
 }
 
 
@@ -204,8 +1455,8 @@ int caseInsensitiveCompare(const char *a, const char *b)
 {
     /* Compare character by character ignoring case */
     for (;;) {
-        unsigned char ca = (unsigned char)tolower((unsigned char)*a);
-        unsigned char cb = (unsigned char)tolower((unsigned char)*b);
+        unsigned char ca = foldChar(*a);
+        unsigned char cb = foldChar(*b);
         if (ca < cb) return -1;
         if (ca > cb) return  1;
         if (ca == 0) return  0;  /* both strings ended */
@@ -227,340 +1478,5224 @@ const char* locationTypeString(LocationType t)
 }
 
 
-static int boatCompareByName(const void *p1, const void *p2)
+static unsigned int hashName(const char *name)
+{
+    /* FNV-1a over the folded bytes, so names differing in case collide */
+    unsigned int h = 2166136261u;
+    for (; *name; name++) {
+        h ^= foldChar(*name);
+        h *= 16777619u;
+    }
+    return h | 0x80000000u;  /* keep clear of SLOT_EMPTY / SLOT_TOMBSTONE */
+}
+
+
+static inline const char* indexKey(const NameIndex *index, const Boat *b)
+{
+    return *(const char *const *)((const char *)b + index->keyOffset);
+}
+
+
+static int nameIndexResize(NameIndex *index, int newSize)
+{
+    NameSlot *slots = (NameSlot *)calloc(newSize, sizeof(NameSlot));
+    if (!slots) return -1;
+
+    /* Re-insert live entries only; tombstones are dropped */
+    for (int i = 0; i < index->size; i++) {
+        if (index->slots[i].boat) {
+            unsigned int j = index->slots[i].hash & (newSize - 1);
+            while (slots[j].hash != SLOT_EMPTY) {
+                j = (j + 1) & (newSize - 1);
+            }
+            slots[j] = index->slots[i];
+        }
+    }
+    free(index->slots);
+    index->slots = slots;
+    index->size  = newSize;
+    index->used  = index->live;
+    return 0;
+}
+
+
+static int nameIndexInsert(NameIndex *index, Boat *b)
+{
+    /* Keep the load factor (tombstones included) below 3/4 */
+    if ((index->used + 1) * 4 > index->size * 3) {
+        int newSize = index->size ? index->size : MIN_INDEX_SIZE;
+        while ((index->live + 1) * 2 > newSize) {
+            newSize *= 2;
+        }
+        if (nameIndexResize(index, newSize) != 0) return -1;
+    }
+
+    unsigned int h = hashName(indexKey(index, b));
+    unsigned int j = h & (index->size - 1);
+    while (index->slots[j].boat) {
+        j = (j + 1) & (index->size - 1);
+    }
+    if (index->slots[j].hash == SLOT_EMPTY) index->used++;
+    index->slots[j].boat = b;
+    index->slots[j].hash = h;
+    index->live++;
+    return 0;
+}
+
+
+static void nameIndexRemove(NameIndex *index, const Boat *b)
+{
+    if (index->size == 0) return;
+
+    unsigned int j = hashName(indexKey(index, b)) & (index->size - 1);
+    while (index->slots[j].hash != SLOT_EMPTY) {
+        if (index->slots[j].boat == b) {
+            index->slots[j].boat = NULL;
+            index->slots[j].hash = SLOT_TOMBSTONE;
+            index->live--;
+            return;
+        }
+        j = (j + 1) & (index->size - 1);
+    }
+}
+
+
+static int boatCompareByName(const void *p1, const void *p2)
+{
+    /* qsort comparator must take two 'const void*' pointers, each to a Boat* */
+    Boat * const *b1 = (Boat **)p1;
+    Boat * const *b2 = (Boat **)p2;
+    if (*b1 == NULL && *b2 == NULL) return 0;
+    if (*b1 == NULL) return 1;   /* push NULLs to the end, if any */
+    if (*b2 == NULL) return -1;
+    return compareKeyedNames((*b1)->sortKey, (*b1)->name,
+                             (*b2)->sortKey, (*b2)->name);
+}
+
+void sortBoatsByName(BoatManager *manager)
+{
+    /* Only sort the active portion (manager->numBoats). */
+    qsort(manager->boats, manager->numBoats, sizeof(Boat*), boatCompareByName);
+}
+
+
+static void initStringPool(StringPool *pool)
+{
+    pool->chunks    = NULL;
+    pool->numChunks = 0;
+    pool->maxChunks = 0;
+    pool->used      = 0;
+    pool->room      = 0;
+    pool->live      = 0;
+    pool->freed     = 0;
+}
+
+
+static void freeStringPool(StringPool *pool)
+{
+    for (int i = 0; i < pool->numChunks; i++) {
+        free(pool->chunks[i]);
+    }
+    free(pool->chunks);
+    initStringPool(pool);
+}
+
+
+static int poolGrowChunks(StringPool *pool, int extra)
+{
+    if (pool->numChunks + extra <= pool->maxChunks) return 0;
+    int newMax = pool->maxChunks ? pool->maxChunks : 16;
+    while (newMax < pool->numChunks + extra) newMax *= 2;
+    char **chunks = (char **)realloc(pool->chunks, newMax * sizeof(char*));
+    if (!chunks) return -1;
+    pool->chunks    = chunks;
+    pool->maxChunks = newMax;
+    return 0;
+}
+
+
+static int poolReserve(StringPool *pool, size_t size)
+{
+    /* Start a new chunk of at least size bytes */
+    if (size < 1) size = 1;
+    if (poolGrowChunks(pool, 1) != 0) return -1;
+    char *chunk = (char *)malloc(size);
+    if (!chunk) return -1;
+    pool->chunks[pool->numChunks++] = chunk;
+    pool->used = 0;
+    pool->room = size;
+    return 0;
+}
+
+
+static const char* poolAdd(StringPool *pool, const char *s, size_t n)
+{
+    /* Copy n bytes of s and a NUL into the pool; NULL if out of memory */
+    if (pool->room - pool->used < n + 1 &&
+        poolReserve(pool, n + 1 > STRING_CHUNK_SIZE ? n + 1 : STRING_CHUNK_SIZE) != 0) {
+        return NULL;
+    }
+    char *copy = pool->chunks[pool->numChunks - 1] + pool->used;
+    memcpy(copy, s, n);
+    copy[n] = '\0';
+    pool->used += n + 1;
+    pool->live += n + 1;
+    return copy;
+}
+
+
+static inline void poolRelease(StringPool *pool, size_t n)
+{
+    pool->live  -= n + 1;
+    pool->freed += n + 1;
+}
+
+
+static int poolAdopt(StringPool *pool, StringPool *from)
+{
+    /* Take over from's chunks (and its newest chunk's free room); from is
+       left empty.  The strings do not move. */
+    if (poolGrowChunks(pool, from->numChunks) != 0) return -1;
+    if (from->numChunks == 0) return 0;
+    memcpy(pool->chunks + pool->numChunks, from->chunks, from->numChunks * sizeof(char*));
+    pool->numChunks += from->numChunks;
+    pool->used   = from->used;
+    pool->room   = from->room;
+    pool->live  += from->live;
+    pool->freed += from->freed;
+    free(from->chunks);
+    initStringPool(from);
+    return 0;
+}
+
+
+static int arenaGrowColumns(BoatArena *arena, int newMax)
+{
+    /* Resize the hot-field arrays to newMax slabs' worth of slots */
+    size_t slots = (size_t)newMax * BOAT_SLAB_SIZE;
+    int *length = (int *)realloc(arena->length, slots * sizeof(int));
+    if (!length) return -1;
+    arena->length = length;
+    unsigned char *locType = (unsigned char *)realloc(arena->locType, slots);
+    if (!locType) return -1;
+    arena->locType = locType;
+    int64_t *owed = (int64_t *)realloc(arena->amountOwed, slots * sizeof(int64_t));
+    if (!owed) return -1;
+    arena->amountOwed = owed;
+    int *locNext = (int *)realloc(arena->locNext, slots * sizeof(int));
+    if (!locNext) return -1;
+    arena->locNext = locNext;
+    return 0;
+}
+
+
+static void arenaReturn(BoatArena *arena, Boat *b)
+{
+    /* Thread the record onto the free list through its own storage */
+    *(Boat **)b = arena->freeList;
+    arena->freeList = b;
+}
+
+
+static Boat* arenaAlloc(BoatArena *arena)
+{
+    /* Reuse a released record first */
+    if (arena->freeList) {
+        Boat *b = arena->freeList;
+        arena->freeList = *(Boat **)b;
+        return b;
+    }
+
+    if (arena->slabUsed == BOAT_SLAB_SIZE) {
+        /* Newest slab is exhausted: start another one */
+        if (arena->numSlabs == arena->maxSlabs) {
+            int newMax = arena->maxSlabs ? arena->maxSlabs * 2 : 8;
+            Boat **slabs = (Boat **)realloc(arena->slabs, newMax * sizeof(Boat*));
+            if (!slabs) return NULL;
+            arena->slabs = slabs;
+            if (arenaGrowColumns(arena, newMax) != 0) return NULL;
+            arena->maxSlabs = newMax;
+        }
+        Boat *slab = (Boat *)malloc(BOAT_SLAB_SIZE * sizeof(Boat));
+        if (!slab) return NULL;
+
+        /* Number the new records and give their slots neutral hot fields */
+        int first = arena->numSlabs * BOAT_SLAB_SIZE;
+        for (int i = 0; i < BOAT_SLAB_SIZE; i++) {
+            slab[i].id = first + i;
+        }
+        memset(&arena->length[first], 0, BOAT_SLAB_SIZE * sizeof(int));
+        memset(&arena->locType[first], 0, BOAT_SLAB_SIZE);
+        memset(&arena->amountOwed[first], 0, BOAT_SLAB_SIZE * sizeof(int64_t));
+
+        arena->slabs[arena->numSlabs++] = slab;
+        arena->slabUsed = 0;
+    }
+    return &arena->slabs[arena->numSlabs - 1][arena->slabUsed++];
+}
+
+
+static inline Boat* arenaBoat(const BoatArena *arena, int id)
+{
+    return &arena->slabs[id / BOAT_SLAB_SIZE][id % BOAT_SLAB_SIZE];
+}
+
+
+static inline int boatLength(const BoatManager *manager, const Boat *b)
+{
+    return manager->arena.length[b->id];
+}
+
+
+static inline int64_t* boatOwed(const BoatManager *manager, const Boat *b)
+{
+    return &manager->arena.amountOwed[b->id];
+}
+
+
+static inline int64_t loadOwed(const BoatManager *manager, const Boat *b)
+{
+    /* For readers of a shared manager, which a payment may overlap */
+    return __atomic_load_n(&manager->arena.amountOwed[b->id], __ATOMIC_RELAXED);
+}
+
+
+static void setBoatHot(BoatManager *manager, const Boat *b, int length,
+                       int64_t owed)
+{
+    manager->arena.length[b->id]     = length;
+    manager->arena.locType[b->id]    = (unsigned char)b->locType;
+    manager->arena.amountOwed[b->id] = owed;
+}
+
+
+static void countBoat(BoatManager *manager, const Boat *b, int sign)
+{
+    /* Add (sign 1) or take away (sign -1) one boat's share of the totals */
+    FleetTotals *t = &manager->totals;
+    int64_t owed = *boatOwed(manager, b);
+    t->count[b->locType] += sign;
+    t->owed[b->locType]  += sign * owed;
+    t->totalOwed         += sign * owed;
+    t->numOwing          += sign * (owed != 0);
+}
+
+
+static void markReshaped(BoatManager *manager)
+{
+    /* Boats came or went, or every balance moved: the data file needs a
+       full rewrite */
+    __atomic_fetch_add(&manager->saved.changes, 1, __ATOMIC_RELAXED);
+    manager->saved.inPlace = 0;
+}
+
+
+static void markBoatDirty(BoatManager *manager, Boat *b)
+{
+    /* Called after the new balance is stored; a save that takes the flag
+       back (acquiring it) is sure to read that balance */
+    if (!__atomic_exchange_n(&b->dirty, 1, __ATOMIC_ACQ_REL)) {
+        __atomic_fetch_add(&manager->saved.dirtyBoats, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&manager->saved.changes, 1, __ATOMIC_RELAXED);
+}
+
+
+static size_t boundedLength(const char *s, size_t max)
+{
+    size_t n = 0;
+    while (n < max && s[n]) n++;
+    return n;
+}
+
+
+static int setBoatName(StringPool *strings, Boat *b, const char *name, size_t n)
+{
+    /* The name's copy goes into strings */
+    if (n > MAX_NAME - 1) n = MAX_NAME - 1;
+    b->name = poolAdd(strings, name, n);
+    if (!b->name) return -1;
+    b->nameLen = (unsigned char)n;
+    b->sortKey = makeSortKey(b->name);
+    return 0;
+}
+
+
+static int setBoatTag(StringPool *strings, Boat *b, const char *tag)
+{
+    /* Trailer tags keep up to MAX_TAG - 1 characters */
+    b->detail.licenseTag = poolAdd(strings, tag, boundedLength(tag, MAX_TAG - 1));
+    return b->detail.licenseTag ? 0 : -1;
+}
+
+
+static void releaseBoatStrings(StringPool *strings, const Boat *b)
+{
+    poolRelease(strings, b->nameLen);
+    if (b->locType == TRAILOR) poolRelease(strings, strlen(b->detail.licenseTag));
+}
+
+
+static const char* skipBlanks(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) p++;
+    return p;
+}
+
+
+static const char* parseIntField(const char *p, const char *end, int *out)
+{
+    /* Optional sign and at least one digit; returns NULL if malformed or
+       past INT_MAX */
+    int neg = 0, value = 0;
+    p = skipBlanks(p, end);
+    if (p < end && (*p == '-' || *p == '+')) {
+        neg = (*p == '-');
+        p++;
+    }
+    const char *digits = p;
+    while (p < end && *p >= '0' && *p <= '9') {
+        if (value > (INT_MAX - (*p - '0')) / 10) return NULL;
+        value = value * 10 + (*p - '0');
+        p++;
+    }
+    if (p == digits) return NULL;
+    *out = neg ? -value : value;
+    return p;
+}
+
+
+static void parseDetail(LocationType locType, const char *detailStr,
+                        LocationDetail *detail)
+{
+    /* Initialize the union depending on location type; a trailer tag is
+       left pointing at detailStr.  A slip or storage number that does not
+       parse is 0. */
+    const char *end = detailStr + strlen(detailStr);
+    int number;
+    if (!parseIntField(detailStr, end, &number)) number = 0;
+    switch (locType) {
+        case SLIP:
+            detail->slipNumber = number;
+            break;
+        case LAND:
+            detail->bayLetter = detailStr[0];  /* e.g. 'C' */
+            break;
+        case TRAILOR:
+            detail->licenseTag = detailStr;
+            break;
+        case STORAGE:
+            detail->storageNum = number;
+            break;
+    }
+}
+
+
+static int initBoat(StringPool *strings, Boat *b, const char *name,
+                    LocationType locType, const char *detailStr)
+{
+    /* Initialize the record fields carefully (hot fields are set apart).
+       The name and a trailer tag are copied into strings; returns -1 if
+       that runs out of memory. */
+    if (setBoatName(strings, b, name, boundedLength(name, MAX_NAME - 1)) != 0) {
+        return -1;
+    }
+    b->locType = (unsigned char)locType;
+    b->dirty   = 0;
+    parseDetail(locType, detailStr, &b->detail);
+    if (locType == TRAILOR && setBoatTag(strings, b, detailStr) != 0) {
+        poolRelease(strings, b->nameLen);
+        return -1;
+    }
+    return 0;
+}
+
+
+Boat* createBoat(BoatManager *manager, const char *name, int length,
+                 LocationType locType, const char *detailStr, int64_t owed)
+{
+    Boat *b = arenaAlloc(&manager->arena);
+    if (!b) {
+        /* Caller can handle error message or fallback if needed. */
+        return NULL;
+    }
+    if (initBoat(&manager->arena.strings, b, name, locType, detailStr) != 0) {
+        arenaReturn(&manager->arena, b);
+        return NULL;
+    }
+    setBoatHot(manager, b, length, owed);
+    return b;
+}
+
+
+void releaseBoat(BoatManager *manager, Boat *b)
+{
+    /* An empty slot must not accrue charges */
+    setBoatHot(manager, b, 0, 0);
+    releaseBoatStrings(&manager->arena.strings, b);
+    arenaReturn(&manager->arena, b);
+}
+
+
+static void compactStrings(BoatManager *manager)
+{
+    /* Once released strings outweigh live ones, copy the live ones into one
+       fresh chunk and free the old chunks.  Only the fleet's own pointers
+       change, and removal - the only caller - holds the fleet exclusively. */
+    StringPool *pool = &manager->arena.strings;
+    if (pool->freed < STRING_CHUNK_SIZE || pool->freed < pool->live) return;
+
+    StringPool fresh;
+    initStringPool(&fresh);
+    if (poolReserve(&fresh, pool->live) != 0) {
+        freeStringPool(&fresh);
+        return;  /* keep the old pool; it is merely loose */
+    }
+    int i = 0;
+    for (; i < manager->numBoats; i++) {
+        const Boat *b = manager->boats[i];
+        if (!poolAdd(&fresh, b->name, b->nameLen) ||
+            (b->locType == TRAILOR &&
+             !poolAdd(&fresh, b->detail.licenseTag, strlen(b->detail.licenseTag)))) {
+            break;
+        }
+    }
+    if (i < manager->numBoats || fresh.numChunks != 1) {
+        freeStringPool(&fresh);
+        return;
+    }
+
+    /* Every copy sits in the one chunk, in fleet order: repoint the records */
+    const char *p = fresh.chunks[0];
+    for (int i = 0; i < manager->numBoats; i++) {
+        Boat *b = manager->boats[i];
+        b->name = p;
+        p += b->nameLen + 1;
+        if (b->locType == TRAILOR) {
+            b->detail.licenseTag = p;
+            p += strlen(p) + 1;
+        }
+    }
+    freeStringPool(pool);
+    *pool = fresh;
+}
+
+
+static int reserveBoats(BoatManager *manager, int extra)
+{
+    /* Make room for 'extra' more pointers, doubling the array as needed */
+    if (manager->numBoats + extra > manager->capacity) {
+        int newCap = manager->capacity ? manager->capacity : MIN_CAPACITY;
+        while (newCap < manager->numBoats + extra) newCap *= 2;
+        Boat **boats = (Boat **)realloc(manager->boats, newCap * sizeof(Boat*));
+        if (!boats) return -1;
+        manager->boats    = boats;
+        manager->capacity = newCap;
+    }
+    return 0;
+}
+
+
+static int lowerBoundByName(const BoatManager *manager, const char *name)
+{
+    /* First position whose name is not less than 'name' */
+    uint64_t key = makeSortKey(name);
+    int lo = 0, hi = manager->numBoats;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        const Boat *m = manager->boats[mid];
+        if (compareKeyedNames(m->sortKey, m->name, key, name) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+
+static int upperBoundByName(const BoatManager *manager, const char *name)
+{
+    /* First position whose name is greater than 'name' */
+    uint64_t key = makeSortKey(name);
+    int lo = 0, hi = manager->numBoats;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        const Boat *m = manager->boats[mid];
+        if (compareKeyedNames(m->sortKey, m->name, key, name) <= 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+
+static int growHeads(int **heads, int *size, int number)
+{
+    /* Make a direct-mapped head array long enough to index number */
+    int newSize = *size ? *size : 64;
+    while (newSize <= number) newSize *= 2;
+    if (newSize > MAX_SPACE_NUMBER) newSize = MAX_SPACE_NUMBER;
+    int *grown = (int *)realloc(*heads, newSize * sizeof(int));
+    if (!grown) return -1;
+    memset(grown + *size, 0xff, (newSize - *size) * sizeof(int));  /* all -1 */
+    *heads = grown;
+    *size  = newSize;
+    return 0;
+}
+
+
+static int* locationChain(LocationIndex *index, LocationType locType,
+                          const LocationDetail *detail, int grow)
+{
+    /* The chain head a slip, bay or storage detail belongs on.  With grow
+       the direct-mapped arrays are extended to cover the number; without,
+       NULL means no boat can be there.  Trailers live in the tag hash. */
+    int number = 0, **heads = NULL, *size = NULL;
+    switch (locType) {
+        case SLIP:
+            number = detail->slipNumber;
+            heads  = &index->slip;
+            size   = &index->slipSize;
+            break;
+        case STORAGE:
+            number = detail->storageNum;
+            heads  = &index->storage;
+            size   = &index->storageSize;
+            break;
+        case LAND: {
+            int c = toupper((unsigned char)detail->bayLetter);
+            return (c >= 'A' && c <= 'Z') ? &index->bay[c - 'A'] : &index->other[LAND];
+        }
+        default:
+            return NULL;
+    }
+    if (number < 0 || number >= MAX_SPACE_NUMBER) return &index->other[locType];
+    if (number >= *size) {
+        if (!grow || growHeads(heads, size, number) != 0) return NULL;
+    }
+    return &(*heads)[number];
+}
+
+
+static int sameLocation(const Boat *a, LocationType locType,
+                        const LocationDetail *detail)
+{
+    if (a->locType != locType) return 0;
+    switch (locType) {
+        case SLIP:    return a->detail.slipNumber == detail->slipNumber;
+        case STORAGE: return a->detail.storageNum == detail->storageNum;
+        case LAND:    return toupper((unsigned char)a->detail.bayLetter) ==
+                             toupper((unsigned char)detail->bayLetter);
+        default:      return caseInsensitiveCompare(a->detail.licenseTag,
+                                                    detail->licenseTag) == 0;
+    }
+}
+
+
+static int locationIndexInsert(BoatManager *manager, Boat *b)
+{
+    LocationIndex *index = &manager->locations;
+    if (b->locType == TRAILOR) return nameIndexInsert(&index->tags, b);
+
+    int *head = locationChain(index, b->locType, &b->detail, 1);
+    if (!head) return -1;
+    manager->arena.locNext[b->id] = *head;
+    *head = b->id;
+    return 0;
+}
+
+
+static void locationIndexRemove(BoatManager *manager, const Boat *b)
+{
+    LocationIndex *index = &manager->locations;
+    if (b->locType == TRAILOR) {
+        nameIndexRemove(&index->tags, b);
+        return;
+    }
+
+    /* Chains are short (one boat per slip, as a rule): walk and unlink */
+    int *link = locationChain(index, b->locType, &b->detail, 0);
+    while (link && *link >= 0) {
+        if (*link == b->id) {
+            *link = manager->arena.locNext[b->id];
+            return;
+        }
+        link = &manager->arena.locNext[*link];
+    }
+}
+
+
+int forEachBoatAt(const BoatManager *manager, LocationType locType,
+                  const char *detail,
+                  void (*visit)(const BoatManager *, const Boat *, void *),
+                  void *ctx)
+{
+    /* Parse the detail exactly the way a CSV row would be, tags cut short
+       as setBoatTag cuts them */
+    char tag[MAX_TAG];
+    size_t n = boundedLength(detail, MAX_TAG - 1);
+    memcpy(tag, detail, n);
+    tag[n] = '\0';
+    LocationDetail probe;
+    parseDetail(locType, tag, &probe);
+    LocationIndex *index = (LocationIndex *)&manager->locations;
+    int found = 0;
+
+    if (locType == TRAILOR) {
+        const NameIndex *tags = &index->tags;
+        if (tags->size == 0) return 0;
+        unsigned int h = hashName(probe.licenseTag);
+        unsigned int j = h & (tags->size - 1);
+        while (tags->slots[j].hash != SLOT_EMPTY) {
+            const Boat *b = tags->slots[j].boat;
+            if (tags->slots[j].hash == h && sameLocation(b, locType, &probe)) {
+                if (visit) visit(manager, b, ctx);
+                found++;
+            }
+            j = (j + 1) & (tags->size - 1);
+        }
+        return found;
+    }
+
+    /* Overflow and bay chains mix details, so every entry is checked */
+    const int *link = locationChain(index, locType, &probe, 0);
+    for (int id = link ? *link : -1; id >= 0; id = manager->arena.locNext[id]) {
+        const Boat *b = arenaBoat(&manager->arena, id);
+        if (sameLocation(b, locType, &probe)) {
+            if (visit) visit(manager, b, ctx);
+            found++;
+        }
+    }
+    return found;
+}
+
+
+int appendBoat(BoatManager *manager, Boat *b)
+{
+    if (reserveBoats(manager, 1) != 0) return -1;
+    if (locationIndexInsert(manager, b) != 0) return -1;
+    if (nameIndexInsert(&manager->nameIndex, b) != 0) {
+        locationIndexRemove(manager, b);
+        return -1;
+    }
+    manager->boats[manager->numBoats++] = b;
+    countBoat(manager, b, 1);
+    return 0;
+}
+
+
+int insertBoat(BoatManager *manager, Boat *b)
+{
+    /* A new boat could land inside any block's range of names */
+    loadRemainingBoats(manager);
+    if (reserveBoats(manager, 1) != 0) return -1;
+    if (locationIndexInsert(manager, b) != 0) return -1;
+    if (nameIndexInsert(&manager->nameIndex, b) != 0) {
+        locationIndexRemove(manager, b);
+        return -1;
+    }
+
+    /* Equal names go after existing ones, matching load order */
+    int pos = upperBoundByName(manager, b->name);
+    memmove(&manager->boats[pos + 1], &manager->boats[pos],
+            (manager->numBoats - pos) * sizeof(Boat*));
+    manager->boats[pos] = b;
+    manager->numBoats++;
+    countBoat(manager, b, 1);
+    markReshaped(manager);
+    return 0;
+}
+
+
+int openMappedFile(MappedFile *mf, const char *filename)
+{
+    mf->data     = NULL;
+    mf->size     = 0;
+    mf->isMapped = 0;
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        if (st.st_size == 0) {
+            close(fd);
+            return 0;
+        }
+        void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+#ifdef MADV_SEQUENTIAL
+            madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+            close(fd);
+            mf->data     = (const char *)p;
+            mf->size     = (size_t)st.st_size;
+            mf->isMapped = 1;
+            return 0;
+        }
+    }
+
+    /* Not mappable: slurp it into a growing heap buffer instead */
+    size_t cap = 1 << 16, len = 0;
+    char *buf = (char *)malloc(cap);
+    ssize_t n;
+    while (buf && (n = read(fd, buf + len, cap - len)) > 0) {
+        len += (size_t)n;
+        if (len == cap) {
+            char *bigger = (char *)realloc(buf, cap * 2);
+            if (!bigger) {
+                free(buf);
+                buf = NULL;
+                break;
+            }
+            buf = bigger;
+            cap *= 2;
+        }
+    }
+    close(fd);
+    if (!buf) return -1;
+    mf->data = buf;
+    mf->size = len;
+    return 0;
+}
+
+
+void closeMappedFile(MappedFile *mf)
+{
+    if (mf->isMapped) {
+        munmap((void *)mf->data, mf->size);
+    } else {
+        free((void *)mf->data);
+    }
+    mf->data = NULL;
+    mf->size = 0;
+}
+
+
+static const char* parseAmountField(const char *p, const char *end, int64_t *out)
+{
+    /* Dollars and cents straight to an integer number of cents, so
+       "1000.07" costs no strtod/sscanf and never rounds through binary
+       floating point.  A third decimal place rounds the cents half away
+       from zero; further places are ignored.  Amounts with an exponent,
+       or too many digits for exact cents, take the strtod path and are
+       refused if they do not fit. */
+    int neg = 0, sawDigit = 0, digits = 0, frac = 0;
+    int64_t whole = 0, cents = 0;
+
+    p = skipBlanks(p, end);
+    const char *start = p;
+    if (p < end && (*p == '-' || *p == '+')) {
+        neg = (*p == '-');
+        p++;
+    }
+    while (p < end && *p >= '0' && *p <= '9') {
+        if (whole || *p != '0') digits++;
+        if (digits <= 16) whole = whole * 10 + (*p - '0');
+        sawDigit = 1;
+        p++;
+    }
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && *p >= '0' && *p <= '9') {
+            if (frac < 2) {
+                cents = cents * 10 + (*p - '0');
+                frac++;
+            } else if (frac == 2) {
+                cents += (*p >= '5');
+                frac++;
+            }
+            sawDigit = 1;
+            p++;
+        }
+    }
+    if (!sawDigit) return NULL;
+    if (frac == 1) cents *= 10;
+
+    if (digits > 16 || (p < end && (*p == 'e' || *p == 'E'))) {
+        char tmp[64], *stop;
+        size_t n = (size_t)(end - start);
+        if (n > sizeof(tmp) - 1) n = sizeof(tmp) - 1;
+        memcpy(tmp, start, n);
+        tmp[n] = '\0';
+        double value = strtod(tmp, &stop) * 100.0;
+        if (!(value > -9e18 && value < 9e18)) return NULL;
+        *out = (int64_t)(value < 0 ? value - 0.5 : value + 0.5);
+        return start + (stop - tmp);
+    }
+
+    int64_t value = whole * 100 + cents;
+    *out = neg ? -value : value;
+    return p;
+}
+
+int parseCsvRow(const char *line, const char *end, CsvRow *row)
+{
+    /*
+     * Each line: boatName,length,locType,detail,owed
+     * Example: "Big Brother,20,slip,27,1450.00"
+     *
+     * The boat name may contain spaces but not commas, so every text field
+     * simply runs up to the next comma.
+     */
+    const char *p = skipBlanks(line, end);
+    const char *comma;
+
+    if (!(comma = memchr(p, ',', end - p)) || comma == p) return 0;
+    row->name    = p;
+    row->nameLen = (int)(comma - p);
+
+    p = parseIntField(comma + 1, end, &row->length);
+    if (!p || p == end || *p != ',') return 0;
+
+    p++;
+    if (!(comma = memchr(p, ',', end - p)) || comma == p) return 0;
+    row->loc    = p;
+    row->locLen = (int)(comma - p);
+
+    p = comma + 1;
+    if (!(comma = memchr(p, ',', end - p)) || comma == p) return 0;
+    row->detail    = p;
+    row->detailLen = (int)(comma - p);
+
+    return parseAmountField(comma + 1, end, &row->owed) != NULL;
+}
+
+
+static int initBoatFromRow(StringPool *strings, Boat *b, const CsvRow *row)
+{
+    /* The record points at NUL-terminated copies of the text fields in
+       strings; returns -1 if that runs out of memory */
+    char boatName[MAX_NAME], locStr[32], detailStr[64];
+    int n;
+
+    n = row->nameLen < MAX_NAME - 1 ? row->nameLen : MAX_NAME - 1;
+    memcpy(boatName, row->name, n);
+    boatName[n] = '\0';
+
+    n = row->locLen < 31 ? row->locLen : 31;
+    memcpy(locStr, row->loc, n);
+    locStr[n] = '\0';
+
+    n = row->detailLen < 63 ? row->detailLen : 63;
+    memcpy(detailStr, row->detail, n);
+    detailStr[n] = '\0';
+
+    return initBoat(strings, b, boatName, parseLocationType(locStr), detailStr);
+}
+
+
+Boat* createBoatFromRow(BoatManager *manager, const CsvRow *row)
+{
+    Boat *b = arenaAlloc(&manager->arena);
+    if (b) {
+        if (initBoatFromRow(&manager->arena.strings, b, row) != 0) {
+            arenaReturn(&manager->arena, b);
+            return NULL;
+        }
+        setBoatHot(manager, b, row->length, row->owed);
+    }
+    return b;
+}
+
+
+void loadFromCSV(BoatManager *manager, const char *filename)
+{
+    MappedFile mf;
+    if (openMappedFile(&mf, filename) != 0) {
+        /* If file does not exist or can't open, we just return an empty manager */
+        return;
+    }
+
+    /* Walk the mapped bytes line by line; there is no line-length limit */
+    const char *p   = mf.data;
+    const char *end = mf.data + mf.size;
+    while (p < end) {
+        const char *eol = memchr(p, '\n', end - p);
+        if (!eol) eol = end;
+
+        CsvRow row;
+        if (parseCsvRow(p, eol, &row)) {
+            Boat *b = createBoatFromRow(manager, &row);
+            if (b && appendBoat(manager, b) != 0) {
+                /* Out of memory for the pointer array: give the record back. */
+                releaseBoat(manager, b);
+            }
+        }
+        /* else if parse fails, we skip that line. */
+        p = eol + 1;
+    }
+
+    closeMappedFile(&mf);
+    /* Finally, ensure sorted after loading. */
+    sortBoatsByName(manager);
+}
+
+
+static void runParallel(void *(*fn)(void *), void *tasks, size_t taskSize,
+                        int numTasks)
+{
+    /* One thread per task; the calling thread runs the last one itself.
+       If a thread cannot be started its task simply runs inline. */
+    pthread_t tids[MAX_THREADS];
+    int started[MAX_THREADS];
+    char *base = (char *)tasks;
+
+    for (int i = 0; i < numTasks - 1; i++) {
+        started[i] = pthread_create(&tids[i], NULL, fn, base + i * taskSize) == 0;
+        if (!started[i]) fn(base + i * taskSize);
+    }
+    fn(base + (numTasks - 1) * taskSize);
+    for (int i = 0; i < numTasks - 1; i++) {
+        if (started[i]) pthread_join(tids[i], NULL);
+    }
+}
+
+
+/* A parsed record plus its hot fields, before it has an arena slot */
+typedef struct {
+    Boat    boat;
+    int     length;
+    int64_t owed;
+} StagedBoat;
+
+/* Per-thread state for loadFromCSVParallel */
+typedef struct {
+    const char *begin, *end;   /* whole lines of the mapped file */
+    StagedBoat *recs;          /* private record buffer */
+    int    numRecs, capRecs;
+    StringPool strings;        /* private pool for the records' strings */
+    Boat **run;                /* this chunk's slice of manager->boats */
+    int    failed;
+} LoadChunk;
+
+/* Merge src[lo,mid) and src[mid,hi) into dst[lo,hi) */
+typedef struct {
+    Boat **src, **dst;
+    int    lo, mid, hi;
+} MergeTask;
+
+
+static void* parseChunkThread(void *arg)
+{
+    LoadChunk *c = (LoadChunk *)arg;
+    const char *p = c->begin;
+    while (p < c->end) {
+        const char *eol = memchr(p, '\n', c->end - p);
+        if (!eol) eol = c->end;
+
+        CsvRow row;
+        if (parseCsvRow(p, eol, &row)) {
+            if (c->numRecs == c->capRecs) {
+                int newCap = c->capRecs ? c->capRecs * 2 : BOAT_SLAB_SIZE;
+                StagedBoat *recs = (StagedBoat *)realloc(c->recs, newCap * sizeof(StagedBoat));
+                if (!recs) {
+                    c->failed = 1;
+                    return NULL;
+                }
+                c->recs    = recs;
+                c->capRecs = newCap;
+            }
+            StagedBoat *s = &c->recs[c->numRecs];
+            if (initBoatFromRow(&c->strings, &s->boat, &row) != 0) {
+                c->failed = 1;
+                return NULL;
+            }
+            c->numRecs++;
+            s->length = row.length;
+            s->owed   = row.owed;
+        }
+        p = eol + 1;
+    }
+    return NULL;
+}
+
+
+static void* sortRunThread(void *arg)
+{
+    LoadChunk *c = (LoadChunk *)arg;
+    qsort(c->run, c->numRecs, sizeof(Boat*), boatCompareByName);
+    return NULL;
+}
+
+
+static void* mergeRunsThread(void *arg)
+{
+    MergeTask *t = (MergeTask *)arg;
+    int i = t->lo, j = t->mid, k = t->lo;
+    while (i < t->mid && j < t->hi) {
+        /* Take from the left run on ties so the merge is stable */
+        if (boatCompareByName(&t->src[j], &t->src[i]) < 0) {
+            t->dst[k++] = t->src[j++];
+        } else {
+            t->dst[k++] = t->src[i++];
+        }
+    }
+    while (i < t->mid) t->dst[k++] = t->src[i++];
+    while (j < t->hi)  t->dst[k++] = t->src[j++];
+    return NULL;
+}
+
+
+void loadFromCSVParallel(BoatManager *manager, const char *filename, int numThreads)
+{
+    MappedFile mf;
+    if (openMappedFile(&mf, filename) != 0) {
+        return;
+    }
+
+    if (numThreads > MAX_THREADS) numThreads = MAX_THREADS;
+    if ((size_t)numThreads > mf.size / MIN_CHUNK) numThreads = (int)(mf.size / MIN_CHUNK);
+    if (numThreads <= 1 || manager->numBoats > 0) {
+        /* Not worth splitting (or merging into existing boats) */
+        closeMappedFile(&mf);
+        loadFromCSV(manager, filename);
+        return;
+    }
+
+    /* Cut the file into roughly equal chunks, each ending after a newline */
+    LoadChunk chunks[MAX_THREADS];
+    const char *end = mf.data + mf.size;
+    const char *p = mf.data;
+    for (int t = 0; t < numThreads; t++) {
+        const char *cut = (t == numThreads - 1) ? end : mf.data + mf.size / numThreads * (t + 1);
+        if (cut < p) cut = p;
+        if (cut < end) {
+            const char *eol = memchr(cut, '\n', end - cut);
+            cut = eol ? eol + 1 : end;
+        }
+        chunks[t].begin   = p;
+        chunks[t].end     = cut;
+        chunks[t].recs    = NULL;
+        chunks[t].numRecs = chunks[t].capRecs = 0;
+        chunks[t].failed  = 0;
+        initStringPool(&chunks[t].strings);
+        p = cut;
+    }
+    runParallel(parseChunkThread, chunks, sizeof(LoadChunk), numThreads);
+    closeMappedFile(&mf);
+
+    /* Move every record into the arena and lay the pointers out run by run */
+    int total = 0;
+    for (int t = 0; t < numThreads; t++) total += chunks[t].numRecs;
+    int ok = reserveBoats(manager, total) == 0;
+    for (int t = 0; t < numThreads; t++) ok = ok && !chunks[t].failed;
+
+    for (int t = 0; t < numThreads; t++) {
+        /* The strings stay where the thread put them; the arena owns them now */
+        if (poolAdopt(&manager->arena.strings, &chunks[t].strings) != 0) {
+            ok = 0;
+            freeStringPool(&chunks[t].strings);
+        }
+        chunks[t].run = manager->boats + manager->numBoats;
+        for (int i = 0; ok && i < chunks[t].numRecs; i++) {
+            Boat *b = arenaAlloc(&manager->arena);
+            if (!b) {
+                ok = 0;
+                break;
+            }
+            const StagedBoat *s = &chunks[t].recs[i];
+            int id = b->id;
+            *b = s->boat;
+            b->id = id;
+            setBoatHot(manager, b, s->length, s->owed);
+            manager->boats[manager->numBoats++] = b;
+            countBoat(manager, b, 1);
+        }
+        /* After a failure the run holds only what was copied */
+        chunks[t].numRecs = (int)(manager->boats + manager->numBoats - chunks[t].run);
+        free(chunks[t].recs);
+    }
+    if (!ok) {
+        fprintf(stderr, "Out of memory while loading '%s'\n", filename);
+    }
+
+    /* Sort each run on its own thread... */
+    runParallel(sortRunThread, chunks, sizeof(LoadChunk), numThreads);
+
+    /* ...then merge neighbouring runs pairwise, in parallel, until one is left */
+    int bounds[MAX_THREADS + 1];
+    int numRuns = numThreads;
+    for (int t = 0; t < numThreads; t++) bounds[t] = (int)(chunks[t].run - manager->boats);
+    bounds[numRuns] = manager->numBoats;
+
+    Boat **tmp = (Boat **)malloc((manager->numBoats + 1) * sizeof(Boat*));
+    Boat **src = manager->boats, **dst = tmp;
+    if (!tmp) sortBoatsByName(manager);
+    while (tmp && numRuns > 1) {
+        MergeTask tasks[MAX_THREADS];
+        int numTasks = 0;
+        for (int r = 0; r < numRuns; r += 2) {
+            MergeTask *mt = &tasks[numTasks++];
+            mt->src = src;
+            mt->dst = dst;
+            mt->lo  = bounds[r];
+            mt->mid = bounds[r + 1];
+            /* An odd run out has nothing to merge with and is just copied */
+            mt->hi  = (r + 2 <= numRuns) ? bounds[r + 2] : bounds[r + 1];
+        }
+        runParallel(mergeRunsThread, tasks, sizeof(MergeTask), numTasks);
+        for (int r = 0; r < numTasks; r++) bounds[r] = tasks[r].lo;
+        bounds[numTasks] = manager->numBoats;
+        numRuns = numTasks;
+        Boat **swap = src;
+        src = dst;
+        dst = swap;
+    }
+    if (src != manager->boats) {
+        memcpy(manager->boats, src, manager->numBoats * sizeof(Boat*));
+    }
+    free(tmp);
+
+    /* Register the fleet in the name and location indexes */
+    for (int i = 0; i < manager->numBoats; i++) {
+        if (nameIndexInsert(&manager->nameIndex, manager->boats[i]) != 0 ||
+            locationIndexInsert(manager, manager->boats[i]) != 0) {
+            fprintf(stderr, "Out of memory while indexing '%s'\n", filename);
+            break;
+        }
+    }
+}
+
+
+static void freeLazyFile(LazyFile *lazy)
+{
+    closeMappedFile(&lazy->file);
+    free(lazy->blocks);
+    freeStringPool(&lazy->names);
+    free(lazy);
+}
+
+
+int openLazyCSV(BoatManager *manager, const char *filename)
+{
+    /* Lookups will insert boats, which readers sharing the fleet lock
+       must not see */
+    if (manager->locks) return -1;
+
+    uint64_t start = statsStart(manager);
+    LazyFile *lazy = (LazyFile *)calloc(1, sizeof(LazyFile));
+    if (!lazy) return -1;
+    initStringPool(&lazy->names);
+    if (snprintf(lazy->path, sizeof(lazy->path), "%s", filename) >= (int)sizeof(lazy->path) ||
+        openMappedFile(&lazy->file, filename) != 0) {
+        free(lazy);
+        return -1;
+    }
+#ifdef MADV_RANDOM
+    /* Neither the sampling nor the lookups read the file in order */
+    if (lazy->file.isMapped) {
+        madvise((void *)lazy->file.data, lazy->file.size, MADV_RANDOM);
+    }
+#endif
+
+    /* Index the first whole line at or after every LAZY_BLOCK_SIZE bytes;
+       only those pages of the file are touched */
+    const char *data = lazy->file.data;
+    const char *end  = data + lazy->file.size;
+    lazy->blocks = (LazyBlock *)malloc((lazy->file.size / LAZY_BLOCK_SIZE + 1) *
+                                       sizeof(LazyBlock));
+    int usable = lazy->blocks != NULL;
+    for (size_t off = 0; usable && off < lazy->file.size; off += LAZY_BLOCK_SIZE) {
+        const char *p = data + off;
+        if (off > 0) {
+            const char *eol = memchr(p - 1, '\n', end - p + 1);
+            if (!eol) break;
+            p = eol + 1;
+        }
+        CsvRow row;
+        int found = 0;
+        while (p < end && !found) {
+            const char *eol = memchr(p, '\n', end - p);
+            if (!eol) eol = end;
+            found = parseCsvRow(p, eol, &row);
+            if (!found) p = eol + 1;
+        }
+        if (!found) break;
+
+        /* A line longer than a block reaches past the next sample */
+        int n = lazy->numBlocks;
+        if (n > 0 && (size_t)(p - data) <= lazy->blocks[n - 1].offset) continue;
+
+        LazyBlock *blk = &lazy->blocks[n];
+        size_t len = row.nameLen < MAX_NAME - 1 ? (size_t)row.nameLen : MAX_NAME - 1;
+        blk->offset = (size_t)(p - data);
+        blk->name   = poolAdd(&lazy->names, row.name, len);
+        blk->loaded = 0;
+        if (!blk->name) {
+            usable = 0;
+            break;
+        }
+        blk->sortKey = makeSortKey(blk->name);
+        if (n > 0 && compareKeyedNames(blk[-1].sortKey, blk[-1].name,
+                                       blk->sortKey, blk->name) > 0) {
+            fprintf(stderr, "'%s' is not sorted by name, so it is loaded in full\n",
+                    filename);
+            usable = 0;
+        }
+        lazy->numBlocks++;
+    }
+    if (!usable) {
+        freeLazyFile(lazy);
+        return -1;
+    }
+
+    lazy->unloaded = lazy->numBlocks;
+    manager->lazy  = lazy;
+    statsStop(manager, STAT_LOAD, start, 0);
+    return 0;
+}
+
+
+static int appendLazyBlock(BoatManager *manager, LazyFile *lazy, int i)
+{
+    /* Add block i's boats to the end of boats[]; returns -1 if its lines
+       turn out not to be in name order, up to the next block's first name */
+    LazyBlock *blk = &lazy->blocks[i];
+    const char *p   = lazy->file.data + blk->offset;
+    const char *end = i + 1 < lazy->numBlocks ? lazy->file.data + blk[1].offset
+                                              : lazy->file.data + lazy->file.size;
+    const Boat *prev = NULL;
+    int sorted = 1;
+    while (p < end) {
+        const char *eol = memchr(p, '\n', end - p);
+        if (!eol) eol = end;
+
+        CsvRow row;
+        if (parseCsvRow(p, eol, &row)) {
+            Boat *b = createBoatFromRow(manager, &row);
+            if (b && appendBoat(manager, b) != 0) {
+                releaseBoat(manager, b);
+            } else if (b) {
+                if (prev && compareKeyedNames(prev->sortKey, prev->name,
+                                              b->sortKey, b->name) > 0) {
+                    sorted = 0;
+                }
+                prev = b;
+            }
+        }
+        p = eol + 1;
+    }
+    blk->loaded = 1;
+    lazy->unloaded--;
+    if (prev && i + 1 < lazy->numBlocks &&
+        compareKeyedNames(prev->sortKey, prev->name, blk[1].sortKey, blk[1].name) > 0) {
+        sorted = 0;
+    }
+    return sorted ? 0 : -1;
+}
+
+
+static void loadNameBlocks(BoatManager *manager, const char *name)
+{
+    /* Boats called name can only be in the blocks from the last one that
+       starts before name through the last one that starts at or before it */
+    LazyFile *lazy = manager->lazy;
+    uint64_t key = makeSortKey(name);
+    int below = 0, upTo = 0;
+    for (int orEqual = 0; orEqual < 2; orEqual++) {
+        int lo = 0, hi = lazy->numBlocks;
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+            int cmp = compareKeyedNames(lazy->blocks[mid].sortKey,
+                                        lazy->blocks[mid].name, key, name);
+            if (cmp < 0 || (orEqual && cmp == 0)) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if (orEqual) upTo = lo; else below = lo;
+    }
+
+    /* Parse each onto the end of boats[], then move it to its sorted place
+       by way of the spare room past the end; no loaded boat falls inside
+       another block's range of names */
+    for (int i = below > 0 ? below - 1 : 0; i < upTo; i++) {
+        if (lazy->blocks[i].loaded) continue;
+        int pos   = upperBoundByName(manager, lazy->blocks[i].name);
+        int first = manager->numBoats;
+        int sorted = appendLazyBlock(manager, lazy, i) == 0;
+        int count  = manager->numBoats - first;
+        if (!sorted || reserveBoats(manager, count) != 0) {
+            if (!sorted) {
+                fprintf(stderr, "'%s' is not sorted by name, so it is loaded in full\n",
+                        lazy->path);
+            }
+            loadRemainingBoats(manager);
+            return;
+        }
+        Boat **boats = manager->boats;
+        memcpy(boats + first + count, boats + first, count * sizeof(Boat*));
+        memmove(boats + pos + count, boats + pos, (first - pos) * sizeof(Boat*));
+        memcpy(boats + pos, boats + first + count, count * sizeof(Boat*));
+    }
+}
+
+
+void loadRemainingBoats(BoatManager *manager)
+{
+    LazyFile *lazy = manager->lazy;
+    if (!lazy) return;
+
+    uint64_t start = statsStart(manager);
+    manager->lazy = NULL;
+    if (lazy->unloaded == lazy->numBlocks && manager->numBoats == 0) {
+        /* Nothing looked up yet: the parallel loader does it all faster */
+        loadFromCSVParallel(manager, lazy->path, manager->billThreads);
+    } else {
+        for (int i = 0; i < lazy->numBlocks; i++) {
+            if (!lazy->blocks[i].loaded) appendLazyBlock(manager, lazy, i);
+        }
+        sortBoatsByName(manager);
+    }
+    freeLazyFile(lazy);
+    statsStop(manager, STAT_LOAD, start, 0);
+}
+
+
+int outOpen(OutBuffer *out, int fd)
+{
+    out->fd     = fd;
+    out->len    = 0;
+    out->cap    = OUT_BUF_SIZE;
+    out->failed = 0;
+    out->buf    = (char *)malloc(OUT_BUF_SIZE);
+    return out->buf ? 0 : -1;
+}
+
+
+void outFlush(OutBuffer *out)
+{
+    if (out->fd < 0) {
+        /* In memory: make room for more rows; if that fails, drop it all */
+        char *grown = (char *)realloc(out->buf, out->cap * 2);
+        if (!grown) {
+            out->failed = 1;
+            out->len = 0;
+            return;
+        }
+        out->buf  = grown;
+        out->cap *= 2;
+        return;
+    }
+
+    /* write() may accept less than asked; keep going until it is all out */
+    size_t done = 0;
+    while (done < out->len && !out->failed) {
+        ssize_t n = write(out->fd, out->buf + done, out->len - done);
+        if (n < 0) {
+            out->failed = 1;
+        } else {
+            done += (size_t)n;
+        }
+    }
+    out->len = 0;
+}
+
+
+int outClose(OutBuffer *out)
+{
+    if (out->fd >= 0) outFlush(out);
+    free(out->buf);
+    out->buf = NULL;
+    return out->failed ? -1 : 0;
+}
+
+
+static inline void outReserve(OutBuffer *out)
+{
+    /* Called once per row: make sure a whole row fits without checks */
+    if (out->len > out->cap - OUT_MAX_ROW) outFlush(out);
+}
+
+
+static inline void outChar(OutBuffer *out, char c)
+{
+    out->buf[out->len++] = c;
+}
+
+
+static inline void outStr(OutBuffer *out, const char *str, size_t n)
+{
+    memcpy(out->buf + out->len, str, n);
+    out->len += n;
+}
+
+
+static void outInt(OutBuffer *out, long long v)
+{
+    /* Digits are produced backwards into a scratch array, then copied */
+    char tmp[24];
+    int n = 0;
+    unsigned long long u = v < 0 ? 0ULL - (unsigned long long)v : (unsigned long long)v;
+    do {
+        tmp[n++] = (char)('0' + u % 10);
+        u /= 10;
+    } while (u);
+    if (v < 0) outChar(out, '-');
+    while (n) outChar(out, tmp[--n]);
+}
+
+
+static size_t centsText(int64_t cents, char *buf)
+{
+    /* Whole cents as plain integer digits, e.g. 145000 -> "1450.00"; buf
+       needs 24 bytes.  Returns the length, without a terminating NUL. */
+    char tmp[24];
+    size_t n = 0, len = 0;
+    uint64_t u = cents < 0 ? 0 - (uint64_t)cents : (uint64_t)cents;
+    tmp[n++] = (char)('0' + u % 10);
+    tmp[n++] = (char)('0' + u / 10 % 10);
+    tmp[n++] = '.';
+    u /= 100;
+    do {
+        tmp[n++] = (char)('0' + u % 10);
+        u /= 10;
+    } while (u);
+    if (cents < 0) buf[len++] = '-';
+    while (n) buf[len++] = tmp[--n];
+    return len;
+}
+
+
+static void outAmount(OutBuffer *out, int64_t cents)
+{
+    char text[24];
+    outStr(out, text, centsText(cents, text));
+}
+
+
+static const char* formatCents(int64_t cents, char *buf, size_t size)
+{
+    /* NUL-terminated counterpart of outAmount, for the interactive messages */
+    char text[24];
+    size_t n = centsText(cents, text);
+    if (n >= size) n = size - 1;
+    memcpy(buf, text, n);
+    buf[n] = '\0';
+    return buf;
+}
+
+
+static void outPadded(OutBuffer *out, const char *str, size_t n, int width,
+                      int leftAlign)
+{
+    /* printf("%*s") / printf("%-*s"): pad with blanks to width */
+    if (!leftAlign) for (size_t i = n; i < (size_t)width; i++) outChar(out, ' ');
+    outStr(out, str, n);
+    if (leftAlign) for (size_t i = n; i < (size_t)width; i++) outChar(out, ' ');
+}
+
+
+static void outIntPadded(OutBuffer *out, long long v, int width)
+{
+    /* printf("%*d") */
+    int n = v < 0 ? 2 : 1;
+    for (long long rest = v / 10; rest; rest /= 10) n++;
+    for (; n < width; n++) outChar(out, ' ');
+    outInt(out, v);
+}
+
+
+static int writeCSV(const BoatManager *manager, int fd)
+{
+    OutBuffer out;
+    if (outOpen(&out, fd) != 0) return -1;
+
+    /* Write each boat in CSV format: name,length,locType,detail,owed */
+    for (int i = 0; i < manager->numBoats; i++) {
+        Boat *b = manager->boats[i];
+        if (!b) continue;  /* safety check */
+
+        const char *loc = locationTypeString(b->locType);
+        outReserve(&out);
+        outStr(&out, b->name, b->nameLen);
+        outChar(&out, ',');
+        outInt(&out, boatLength(manager, b));
+        outChar(&out, ',');
+        outStr(&out, loc, strlen(loc));
+        outChar(&out, ',');
+        switch (b->locType) {
+            case SLIP:
+                outInt(&out, b->detail.slipNumber);
+                break;
+            case LAND:
+                outChar(&out, b->detail.bayLetter);
+                break;
+            case TRAILOR:
+                outStr(&out, b->detail.licenseTag, strlen(b->detail.licenseTag));
+                break;
+            case STORAGE:
+                outInt(&out, b->detail.storageNum);
+                break;
+        }
+        outChar(&out, ',');
+        outAmount(&out, *boatOwed(manager, b));
+        outChar(&out, '\n');
+    }
+    return outClose(&out);
+}
+
+
+void saveToCSV(const BoatManager *manager, const char *filename)
+{
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0 || writeCSV(manager, fd) != 0) {
+        fprintf(stderr, "Unable to write file '%s'\n", filename);
+    }
+    if (fd >= 0) close(fd);
+}
+
+
+static int policyWantsFsync(SavePolicy *policy, time_t now)
+{
+    switch (policy->fsyncMode) {
+        case FSYNC_ALWAYS:
+            return 1;
+        case FSYNC_PERIODIC:
+            return now - policy->lastFsync >= policy->fsyncInterval;
+        case FSYNC_NEVER:
+            break;
+    }
+    return 0;
+}
+
+
+static void fsyncParentDir(const char *filename)
+{
+    /* Make the rename itself durable by syncing the containing directory */
+    char dir[MAX_PATH_LEN];
+    const char *slash = strrchr(filename, '/');
+    if (!slash) {
+        strcpy(dir, ".");
+    } else if (slash == filename) {
+        strcpy(dir, "/");
+    } else {
+        size_t n = (size_t)(slash - filename);
+        if (n >= sizeof(dir)) return;
+        memcpy(dir, filename, n);
+        dir[n] = '\0';
+    }
+    int fd = open(dir, O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+
+static int saveAtomic(const BoatManager *manager, const char *filename,
+                      SavePolicy *policy,
+                      int (*writer)(const BoatManager *, int))
+{
+    char tmpName[MAX_PATH_LEN];
+    if (snprintf(tmpName, sizeof(tmpName), "%s.%ld.tmp", filename,
+                 (long)getpid()) >= (int)sizeof(tmpName)) {
+        fprintf(stderr, "Unable to write file '%s'\n", filename);
+        return -1;
+    }
+
+    int fd = open(tmpName, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        fprintf(stderr, "Unable to write file '%s'\n", tmpName);
+        return -1;
+    }
+
+    /* Keep the permissions of the file being replaced */
+    struct stat st;
+    if (stat(filename, &st) == 0) {
+        fchmod(fd, st.st_mode & 07777);
+    }
+
+    time_t now = time(NULL);
+    int syncing = policyWantsFsync(policy, now);
+    int ok = writer(manager, fd) == 0;
+    if (ok && syncing) ok = fsync(fd) == 0;
+    if (close(fd) != 0) ok = 0;
+    if (ok) ok = rename(tmpName, filename) == 0;
+
+    if (!ok) {
+        fprintf(stderr, "Unable to write file '%s'\n", filename);
+        unlink(tmpName);
+        return -1;
+    }
+    if (syncing) {
+        fsyncParentDir(filename);
+        policy->lastFsync = now;
+    }
+    policy->lastSave = now;
+    return 0;
+}
+
+
+int saveToCSVAtomic(const BoatManager *manager, const char *filename,
+                    SavePolicy *policy)
+{
+    return saveAtomic(manager, filename, policy, writeCSV);
+}
+
+
+DataFormat dataFormatForFile(const char *filename)
+{
+    size_t n = strlen(filename);
+    if (n >= 4 && caseInsensitiveCompare(filename + n - 4, ".mbs") == 0) {
+        return FORMAT_BINARY;
+    }
+    return FORMAT_CSV;
+}
+
+
+static void snapshotIdentity(const char *filename, uint64_t id[3])
+{
+    /* Every atomic save creates a new inode, so (inode, size, mtime) changes
+       whenever the snapshot is replaced.  A missing file is all zeros. */
+    struct stat st;
+    id[0] = id[1] = id[2] = 0;
+    if (stat(filename, &st) == 0) {
+        id[0] = (uint64_t)st.st_ino;
+        id[1] = (uint64_t)st.st_size;
+        id[2] = (uint64_t)st.st_mtime;
+    }
+}
+
+
+static const char SNAPSHOT_MAGIC[8] = { 'M', 'B', 'S', 'N', 'A', 'P', 0, 0 };
+
+
+static void storeDetail(const Boat *b, StoredDetail *stored)
+{
+    /* Zero-filled, so the bytes written never depend on what went before */
+    memset(stored, 0, sizeof(*stored));
+    switch (b->locType) {
+        case SLIP:    stored->slipNumber = b->detail.slipNumber; break;
+        case LAND:    stored->bayLetter  = b->detail.bayLetter;  break;
+        case STORAGE: stored->storageNum = b->detail.storageNum; break;
+        default:
+            memcpy(stored->licenseTag, b->detail.licenseTag,
+                   strlen(b->detail.licenseTag));
+            break;
+    }
+}
+
+
+static int restoreDetail(StringPool *strings, Boat *b, unsigned int locType,
+                         const StoredDetail *stored)
+{
+    /* The inverse of storeDetail; returns -1, leaving b as it was, if a
+       tag cannot be copied */
+    switch (locType & 3) {
+        case SLIP:    b->detail.slipNumber = stored->slipNumber; break;
+        case LAND:    b->detail.bayLetter  = stored->bayLetter;  break;
+        case STORAGE: b->detail.storageNum = stored->storageNum; break;
+        default: {
+            char tag[MAX_TAG];
+            memcpy(tag, stored->licenseTag, MAX_TAG - 1);
+            tag[MAX_TAG - 1] = '\0';
+            if (setBoatTag(strings, b, tag) != 0) return -1;
+            break;
+        }
+    }
+    b->locType = (unsigned char)(locType & 3);
+    return 0;
+}
+
+
+int loadSnapshot(BoatManager *manager, const char *filename)
+{
+    MappedFile mf;
+    if (openMappedFile(&mf, filename) != 0 || mf.size == 0) {
+        /* Missing or empty: start with an empty fleet, as for CSV */
+        return 0;
+    }
+
+    /* Validate the header and that every section lies inside the file */
+    SnapshotHeader hdr;
+    int ok = mf.size >= sizeof(hdr);
+    if (ok) {
+        memcpy(&hdr, mf.data, sizeof(hdr));
+        ok = memcmp(hdr.magic, SNAPSHOT_MAGIC, 8) == 0 &&
+             hdr.version == SNAPSHOT_VERSION &&
+             hdr.recordSize == sizeof(SnapshotRecord) &&
+             hdr.numRecords <= (mf.size - sizeof(hdr)) / sizeof(SnapshotRecord) &&
+             hdr.stringsSize == mf.size - sizeof(hdr) -
+                                hdr.numRecords * sizeof(SnapshotRecord);
+    }
+    if (!ok) {
+        fprintf(stderr, "'%s' is not a valid boat snapshot\n", filename);
+        closeMappedFile(&mf);
+        return -1;
+    }
+
+    const SnapshotRecord *recs = (const SnapshotRecord *)(mf.data + sizeof(hdr));
+    const char *strings = (const char *)(recs + hdr.numRecords);
+    if (reserveBoats(manager, (int)hdr.numRecords) != 0) {
+        closeMappedFile(&mf);
+        return -1;
+    }
+
+    /* Loaded whole into an empty fleet, the file can later be patched in place */
+    int inPlace = manager->numBoats == 0;
+    for (uint64_t i = 0; i < hdr.numRecords; i++) {
+        const SnapshotRecord *r = &recs[i];
+        if ((uint64_t)r->nameOffset + r->nameLength >= hdr.stringsSize ||
+            r->nameLength >= MAX_NAME) {
+            continue;  /* corrupt entry: skip it rather than read past the end */
+        }
+        Boat *b = arenaAlloc(&manager->arena);
+        if (!b) break;
+        b->dirty = 0;
+        StringPool *pool = &manager->arena.strings;
+        if (setBoatName(pool, b, strings + r->nameOffset, r->nameLength) != 0) {
+            arenaReturn(&manager->arena, b);
+            break;
+        }
+        if (restoreDetail(pool, b, r->locType, &r->detail) != 0) {
+            poolRelease(pool, b->nameLen);
+            arenaReturn(&manager->arena, b);
+            break;
+        }
+        setBoatHot(manager, b, r->length, r->amountOwed);
+
+        /* Written in name order, so appending keeps the array sorted */
+        if (appendBoat(manager, b) != 0) {
+            releaseBoat(manager, b);
+            break;
+        }
+    }
+    closeMappedFile(&mf);
+    if (inPlace && (uint64_t)manager->numBoats == hdr.numRecords) {
+        manager->saved.inPlace = 1;
+        snapshotIdentity(filename, manager->saved.fileId);
+    }
+    return 0;
+}
+
+
+static int writeSnapshot(const BoatManager *manager, int fd)
+{
+    SnapshotHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SNAPSHOT_MAGIC, 8);
+    hdr.version    = SNAPSHOT_VERSION;
+    hdr.recordSize = sizeof(SnapshotRecord);
+    hdr.numRecords = (uint64_t)manager->numBoats;
+    for (int i = 0; i < manager->numBoats; i++) {
+        hdr.stringsSize += manager->boats[i]->nameLen + 1u;
+    }
+
+    OutBuffer out;
+    if (outOpen(&out, fd) != 0) return -1;
+    outStr(&out, (const char *)&hdr, sizeof(hdr));
+
+    uint32_t offset = 0;
+    for (int i = 0; i < manager->numBoats; i++) {
+        const Boat *b = manager->boats[i];
+        SnapshotRecord r;
+        memset(&r, 0, sizeof(r));
+        r.nameOffset = offset;
+        r.nameLength = b->nameLen;
+        r.length     = boatLength(manager, b);
+        r.locType    = (uint32_t)b->locType;
+        storeDetail(b, &r.detail);
+        r.amountOwed = *boatOwed(manager, b);
+        offset += r.nameLength + 1;
+
+        outReserve(&out);
+        outStr(&out, (const char *)&r, sizeof(r));
+    }
+    for (int i = 0; i < manager->numBoats; i++) {
+        const Boat *b = manager->boats[i];
+        outReserve(&out);
+        outStr(&out, b->name, b->nameLen + 1u);
+    }
+    return outClose(&out);
+}
+
+
+int saveSnapshotAtomic(const BoatManager *manager, const char *filename,
+                       SavePolicy *policy)
+{
+    return saveAtomic(manager, filename, policy, writeSnapshot);
+}
+
+
+int loadFleet(BoatManager *manager, const char *filename, DataFormat format,
+              int numThreads)
+{
+    uint64_t start = statsStart(manager);
+    int status = 0;
+    if (format == FORMAT_BINARY) {
+        status = loadSnapshot(manager, filename);
+    } else {
+        loadFromCSVParallel(manager, filename, numThreads);
+    }
+    statsStop(manager, STAT_LOAD, start, status != 0);
+    return status;
+}
+
+
+int saveFleet(const BoatManager *manager, const char *filename,
+              DataFormat format, SavePolicy *policy)
+{
+    uint64_t start = statsStart(manager);
+    int status = format == FORMAT_BINARY
+               ? saveSnapshotAtomic(manager, filename, policy)
+               : saveToCSVAtomic(manager, filename, policy);
+    statsStop(manager, STAT_SAVE, start, status != 0);
+    return status;
+}
+
+
+static int patchSnapshot(BoatManager *manager, const char *filename,
+                         SavePolicy *policy)
+{
+    /* Rewrite the balance of each dirty boat's record where it sits.  Each
+       is one aligned 8-byte write; the records stay valid if a crash stops
+       this partway, holding some new balances and some old. */
+    int fd = open(filename, O_WRONLY);
+    if (fd < 0) return -1;
+    int status = 0;
+    for (int i = 0; i < manager->numBoats && status == 0; i++) {
+        Boat *b = manager->boats[i];
+        if (!__atomic_exchange_n(&b->dirty, 0, __ATOMIC_ACQ_REL)) continue;
+        __atomic_fetch_sub(&manager->saved.dirtyBoats, 1, __ATOMIC_RELAXED);
+        int64_t owed = loadOwed(manager, b);
+        off_t at = (off_t)(sizeof(SnapshotHeader) + (size_t)i * sizeof(SnapshotRecord) +
+                           offsetof(SnapshotRecord, amountOwed));
+        if (pwrite(fd, &owed, sizeof(owed), at) != (ssize_t)sizeof(owed)) status = -1;
+    }
+    time_t now = time(NULL);
+    if (status == 0 && policyWantsFsync(policy, now)) {
+        status = fsync(fd) == 0 ? 0 : -1;
+        policy->lastFsync = now;
+    }
+    if (close(fd) != 0) status = -1;
+    if (status == 0) policy->lastSave = now;
+    return status;
+}
+
+
+static void clearDirtyBoats(BoatManager *manager)
+{
+    /* Before a full save, which writes every balance anyway */
+    if (__atomic_load_n(&manager->saved.dirtyBoats, __ATOMIC_RELAXED) == 0) return;
+    for (int i = 0; i < manager->numBoats; i++) {
+        if (__atomic_exchange_n(&manager->boats[i]->dirty, 0, __ATOMIC_ACQ_REL)) {
+            __atomic_fetch_sub(&manager->saved.dirtyBoats, 1, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+
+int saveChanges(BoatManager *manager, const char *filename,
+                DataFormat format, SavePolicy *policy)
+{
+    SaveState *saved = &manager->saved;
+    uint64_t changes = __atomic_load_n(&saved->changes, __ATOMIC_RELAXED);
+    if (changes == saved->savedChanges) {
+        /* Nothing to write: the file already says all of it */
+        policy->lastSave = time(NULL);
+        return 0;
+    }
+    loadRemainingBoats(manager);  /* a lazily read file is CSV: rewritten whole */
+
+    /* A few payments: patch those records, if the file is still ours */
+    uint64_t id[3];
+    snapshotIdentity(filename, id);
+    int patch = format == FORMAT_BINARY && saved->inPlace &&
+                memcmp(id, saved->fileId, sizeof(id)) == 0 &&
+                __atomic_load_n(&saved->dirtyBoats, __ATOMIC_RELAXED) <= manager->numBoats / 16;
+
+    uint64_t start = statsStart(manager);
+    int status;
+    if (patch) {
+        status = patchSnapshot(manager, filename, policy);
+        statsStop(manager, STAT_SAVE, start, status != 0);
+        if (status != 0) fprintf(stderr, "Unable to write file '%s'\n", filename);
+    } else {
+        clearDirtyBoats(manager);
+        status = saveFleet(manager, filename, format, policy);
+    }
+    saved->inPlace = status == 0 && format == FORMAT_BINARY;
+    if (status == 0) {
+        saved->savedChanges = changes;
+        if (saved->inPlace) snapshotIdentity(filename, saved->fileId);
+    }
+    return status;
+}
+
+
+static unsigned int journalChecksum(const unsigned char *p, size_t n)
+{
+    unsigned int h = 2166136261u;
+    while (n--) {
+        h ^= *p++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+
+static const char JOURNAL_MAGIC[8] = { 'M', 'B', 'J', 'R', 'N', 'L', '0', '2' };
+#define JOURNAL_HEADER_SIZE (8 + 3 * 8)
+
+
+static int journalWriteAll(int fd, const void *buf, size_t n)
+{
+    const char *p = (const char *)buf;
+    while (n > 0) {
+        ssize_t w = write(fd, p, n);
+        if (w < 0) return -1;
+        p += w;
+        n -= (size_t)w;
+    }
+    return 0;
+}
+
+
+static int journalReset(Journal *journal, const char *filename)
+{
+    /* Build the new, empty journal under a temporary name and rename it into
+       place, so a crash never leaves a half-written header behind. */
+    char tmpName[MAX_PATH_LEN];
+    if (snprintf(tmpName, sizeof(tmpName), "%s.%ld.tmp", journal->path,
+                 (long)getpid()) >= (int)sizeof(tmpName)) {
+        return -1;
+    }
+    int fd = open(tmpName, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) return -1;
+
+    unsigned char header[JOURNAL_HEADER_SIZE];
+    uint64_t id[3];
+    snapshotIdentity(filename, id);
+    memcpy(header, JOURNAL_MAGIC, 8);
+    memcpy(header + 8, id, sizeof(id));
+
+    int ok = journalWriteAll(fd, header, sizeof(header)) == 0;
+    if (ok && journal->policy->fsyncMode != FSYNC_NEVER) ok = fsync(fd) == 0;
+    if (close(fd) != 0) ok = 0;
+    if (ok) ok = rename(tmpName, journal->path) == 0;
+    if (!ok) {
+        unlink(tmpName);
+        return -1;
+    }
+
+    if (journal->fd >= 0) close(journal->fd);
+    journal->fd   = open(journal->path, O_WRONLY | O_APPEND);
+    journal->size = JOURNAL_HEADER_SIZE;
+    return journal->fd >= 0 ? 0 : -1;
+}
+
+
+int journalOpen(Journal *journal, const char *filename, SavePolicy *policy,
+                off_t validSize)
+{
+    journal->fd     = -1;
+    journal->size   = 0;
+    journal->policy = policy;
+    if (snprintf(journal->path, sizeof(journal->path), "%s.journal",
+                 filename) >= (int)sizeof(journal->path)) {
+        return -1;
+    }
+
+    if (validSize < JOURNAL_HEADER_SIZE) {
+        return journalReset(journal, filename);
+    }
+
+    /* Continue the replayed journal, dropping any torn record at its end */
+    journal->fd = open(journal->path, O_WRONLY | O_APPEND);
+    if (journal->fd < 0 || ftruncate(journal->fd, validSize) != 0) {
+        return -1;
+    }
+    journal->size = validSize;
+    return 0;
+}
+
+
+void journalClose(Journal *journal)
+{
+    if (journal->fd < 0) return;
+    if (journal->policy->fsyncMode != FSYNC_NEVER) fsync(journal->fd);
+    close(journal->fd);
+    journal->fd = -1;
+}
+
+
+static void journalAppend(Journal *journal, JournalOp op,
+                          const unsigned char *payload, unsigned int len)
+{
+    /* Frame: u32 length | u8 op | payload | u32 checksum(op + payload) */
+    unsigned char rec[4 + 1 + JOURNAL_MAX_PAYLOAD + 4];
+    if (journal->fd < 0 || len > JOURNAL_MAX_PAYLOAD) return;
+
+    memcpy(rec, &len, 4);
+    rec[4] = (unsigned char)op;
+    memcpy(rec + 5, payload, len);
+    unsigned int check = journalChecksum(rec + 4, len + 1);
+    memcpy(rec + 5 + len, &check, 4);
+
+    if (journalWriteAll(journal->fd, rec, len + 9) != 0) {
+        fprintf(stderr, "Unable to write journal '%s'\n", journal->path);
+        return;
+    }
+    journal->size += len + 9;
+
+    time_t now = time(NULL);
+    if (policyWantsFsync(journal->policy, now)) {
+        fsync(journal->fd);
+        journal->policy->lastFsync = now;
+    }
+}
+
+
+static void setFlatRates(RateTable *table, const int64_t flat[4])
+{
+    /* Same per-foot rate for every length of each location */
+    for (int loc = 0; loc < 4; loc++) {
+        for (int n = 0; n < RATE_LENGTHS; n++) {
+            table->perFoot[loc][n] = flat[loc];
+        }
+    }
+}
+
+
+static void journalRecord(BoatManager *manager, JournalOp op, const Boat *b,
+                          int64_t amount)
+{
+    /* Serialize one change; a no-op unless journaling is enabled */
+    unsigned char payload[256];
+    unsigned int len = 0;
+    if (!manager->journal) return;
+
+    if (b) {
+        unsigned char nameLen = b->nameLen;
+        payload[len++] = nameLen;
+        memcpy(payload + len, b->name, nameLen);
+        len += nameLen;
+    }
+    if (op == JOURNAL_ADD) {
+        int32_t length = boatLength(manager, b);
+        memcpy(payload + len, &length, 4);
+        len += 4;
+        payload[len++] = (unsigned char)b->locType;
+        StoredDetail stored;
+        storeDetail(b, &stored);
+        memcpy(payload + len, &stored, sizeof(StoredDetail));
+        len += sizeof(StoredDetail);
+        memcpy(payload + len, boatOwed(manager, b), sizeof(int64_t));
+        len += sizeof(int64_t);
+    } else if (op == JOURNAL_PAYMENT) {
+        memcpy(payload + len, &amount, sizeof(int64_t));
+        len += sizeof(int64_t);
+    }
+    journalAppend(manager->journal, op, payload, len);
+}
+
+
+static int replayRecord(BoatManager *manager, JournalOp op,
+                        const unsigned char *p, unsigned int len)
+{
+    /* Decode and apply one record; returns 0 if it is malformed */
+    char name[MAX_NAME];
+    unsigned int pos = 0;
+
+    if (op != JOURNAL_MONTH) {
+        if (len < 1 || p[0] >= MAX_NAME || len < 1u + p[0]) return 0;
+        memcpy(name, p + 1, p[0]);
+        name[p[0]] = '\0';
+        pos = 1u + p[0];
+    }
+
+    switch (op) {
+        case JOURNAL_ADD: {
+            if (len != pos + 4 + 1 + sizeof(StoredDetail) + sizeof(int64_t)) return 0;
+            Boat *b = createBoat(manager, name, 0, SLIP, "0", 0);
+            if (!b) return 0;
+            int32_t length;
+            int64_t owed;
+            StoredDetail stored;
+            memcpy(&length, p + pos, 4);
+            memcpy(&stored, p + pos + 5, sizeof(StoredDetail));
+            memcpy(&owed, p + pos + 5 + sizeof(StoredDetail), sizeof(int64_t));
+            if (restoreDetail(&manager->arena.strings, b, p[pos + 4], &stored) != 0) {
+                releaseBoat(manager, b);
+                return 0;
+            }
+            setBoatHot(manager, b, length, owed);
+            if (insertBoat(manager, b) != 0) {
+                releaseBoat(manager, b);
+                return 0;
+            }
+            break;
+        }
+        case JOURNAL_REMOVE: {
+            int idx = findBoatIndex(manager, name);
+            if (idx >= 0) removeBoatAt(manager, idx);
+            break;
+        }
+        case JOURNAL_PAYMENT: {
+            if (len != pos + sizeof(int64_t)) return 0;
+            int64_t amount;
+            memcpy(&amount, p + pos, sizeof(int64_t));
+            Boat *b = findBoat(manager, name);
+            if (b) applyPayment(manager, b, amount);
+            break;
+        }
+        case JOURNAL_MONTH: {
+            if (len != sizeof(RateTable)) return 0;
+            RateTable table;
+            memcpy(&table, p, sizeof(table));
+            billRates(manager, &table, NULL);
+            break;
+        }
+        default:
+            return 0;
+    }
+    return 1;
+}
+
+
+off_t replayJournal(BoatManager *manager, const char *filename)
+{
+    char path[MAX_PATH_LEN];
+    if (snprintf(path, sizeof(path), "%s.journal", filename) >= (int)sizeof(path)) {
+        return 0;
+    }
+    MappedFile mf;
+    if (openMappedFile(&mf, path) != 0) return 0;
+
+    /* Only a journal written against this very snapshot may be replayed */
+    uint64_t id[3];
+    snapshotIdentity(filename, id);
+    if (mf.size < JOURNAL_HEADER_SIZE || memcmp(mf.data, JOURNAL_MAGIC, 8) != 0 ||
+        memcmp(mf.data + 8, id, sizeof(id)) != 0) {
+        closeMappedFile(&mf);
+        return 0;
+    }
+
+    /* Replay must not log the changes it re-applies */
+    struct Journal *saved = manager->journal;
+    manager->journal = NULL;
+
+    const unsigned char *base = (const unsigned char *)mf.data;
+    size_t pos = JOURNAL_HEADER_SIZE;
+    while (pos + 9 <= mf.size) {
+        unsigned int len, check;
+        memcpy(&len, base + pos, 4);
+        if (len > JOURNAL_MAX_PAYLOAD || pos + 9 + len > mf.size) break;
+        memcpy(&check, base + pos + 5 + len, 4);
+        if (check != journalChecksum(base + pos + 4, len + 1)) break;
+        if (!replayRecord(manager, (JournalOp)base[pos + 4], base + pos + 5, len)) break;
+        pos += 9 + len;
+    }
+
+    manager->journal = saved;
+    closeMappedFile(&mf);
+    return (off_t)pos;
+}
+
+
+int compactJournal(BoatManager *manager, const char *filename, DataFormat format,
+                   Journal *journal)
+{
+    loadRemainingBoats(manager);  /* the snapshot holds every boat */
+
+    /* If the snapshot write fails the old snapshot and journal are still paired */
+    if (saveFleet(manager, filename, format, journal->policy) != 0) return -1;
+    if (journalReset(journal, filename) != 0) {
+        fprintf(stderr, "Unable to write journal '%s'\n", journal->path);
+        return -1;
+    }
+    return 0;
+}
+
+
+static void outBoatLine(const BoatManager *manager, const Boat *b, void *ctx)
+{
+    /*
+     * Example line format from the spec:
+     *   Big Brother           20'    slip   # 27   Owes $1200.00
+     *
+     * Columns are padded by hand to the widths the original printf used,
+     * so the text is unchanged.  ctx is the OutBuffer.
+     */
+    OutBuffer *out = (OutBuffer *)ctx;
+    char owed[24];
+    size_t owedLen = centsText(loadOwed(manager, b), owed);
+    outReserve(out);
+
+    /* Print the boat name left-justified in ~22 spaces. */
+    outPadded(out, b->name, b->nameLen, 22, 1);
+    outChar(out, ' ');
+    outIntPadded(out, boatLength(manager, b), 2);
+    outStr(out, "' ", 2);
+
+    switch (b->locType) {
+        case SLIP:
+            outStr(out, "   slip   # ", 12);
+            outIntPadded(out, b->detail.slipNumber, 2);
+            break;
+        case LAND:
+            outStr(out, "   land      ", 13);
+            outChar(out, b->detail.bayLetter);
+            break;
+        case TRAILOR:
+            outStr(out, "trailor ", 8);
+            outPadded(out, b->detail.licenseTag, strlen(b->detail.licenseTag), 6, 0);
+            break;
+        case STORAGE:
+            outStr(out, "storage   # ", 12);
+            outIntPadded(out, b->detail.storageNum, 2);
+            break;
+    }
+    outStr(out, "   Owes $", 9);
+    outPadded(out, owed, owedLen, 7, 0);
+    outChar(out, '\n');
+}
+
+
+static void initInventoryFilter(InventoryFilter *filter)
+{
+    filter->locType    = -1;
+    filter->hasMinOwed = 0;
+    filter->minOwed    = 0;
+    filter->prefix[0]  = '\0';
+    filter->offset     = 0;
+    filter->limit      = -1;
+}
+
+
+static inline int inventoryShows(const BoatManager *manager, const Boat *b,
+                                 const InventoryFilter *filter)
+{
+    /* The filter's conditions other than the name prefix */
+    if (filter->locType >= 0 && (int)b->locType != filter->locType) return 0;
+    if (filter->hasMinOwed && loadOwed(manager, b) <= filter->minOwed) return 0;
+    return 1;
+}
+
+
+long writeInventory(const BoatManager *manager, OutBuffer *out,
+                    const InventoryFilter *filter)
+{
+    InventoryFilter all;
+    if (!filter) {
+        initInventoryFilter(&all);
+        filter = &all;
+    }
+
+    /* Names are sorted case-insensitively, so boats sharing a prefix are
+       contiguous: only that range is scanned */
+    int i = 0, stop = manager->numBoats;
+    if (filter->prefix[0]) {
+        stop = findBoatsByPrefix(manager, filter->prefix, &i);
+        stop += i;
+    }
+    long skipped = 0, rows = 0;
+    for (; i < stop; i++) {
+        const Boat *b = manager->boats[i];
+        if (!b) continue;  /* skip nulls if any exist */
+        if (!inventoryShows(manager, b, filter)) continue;
+        if (skipped < filter->offset) {
+            skipped++;
+            continue;
+        }
+        if (filter->limit >= 0 && rows >= filter->limit) break;
+        outBoatLine(manager, b, out);
+        rows++;
+    }
+    return rows;
+}
+
+
+void printInventory(const BoatManager *manager, const InventoryFilter *filter)
+{
+    /* Anything already printed through stdio must come out first */
+    OutBuffer out;
+    fflush(stdout);
+    if (outOpen(&out, STDOUT_FILENO) != 0) return;
+    writeInventory(manager, &out, filter);
+    outChar(&out, '\n');
+    outClose(&out);
+}
+
+
+int parseInventoryFilter(const char *p, const char *end, InventoryFilter *filter)
+{
+    initInventoryFilter(filter);
+    while (p < end) {
+        const char *comma = memchr(p, ',', (size_t)(end - p));
+        const char *stop = comma ? comma : end;
+        const char *term = skipBlanks(p, stop);
+        while (stop > term && isspace((unsigned char)stop[-1])) stop--;
+        size_t n = (size_t)(stop - term);
+        int value;
+
+        if (n == 0) {
+            /* empty term, e.g. a trailing comma */
+        } else if (n > 4 && strncasecmp(term, "loc=", 4) == 0) {
+            filter->locType = matchLocationType(term + 4, n - 4);
+            if (filter->locType < 0) return -1;
+        } else if (n > 5 && strncasecmp(term, "owed>", 5) == 0) {
+            const char *q = parseAmountField(term + 5, stop, &filter->minOwed);
+            if (!q || q != stop) return -1;
+            filter->hasMinOwed = 1;
+        } else if (n > 5 && strncasecmp(term, "name=", 5) == 0) {
+            if (n - 5 >= MAX_NAME) return -1;
+            memcpy(filter->prefix, term + 5, n - 5);
+            filter->prefix[n - 5] = '\0';
+        } else if (n > 7 && strncasecmp(term, "offset=", 7) == 0) {
+            const char *q = parseIntField(term + 7, stop, &value);
+            if (!q || q != stop || value < 0) return -1;
+            filter->offset = value;
+        } else if (n > 6 && strncasecmp(term, "limit=", 6) == 0) {
+            const char *q = parseIntField(term + 6, stop, &value);
+            if (!q || q != stop || value < 0) return -1;
+            filter->limit = value;
+        } else {
+            return -1;
+        }
+        p = comma ? comma + 1 : end;
+    }
+    return 0;
+}
+
+
+static void initReceivablesQuery(ReceivablesQuery *query)
+{
+    query->top     = 0;
+    query->locType = -1;
+    query->minOwed = 0;
+}
+
+
+int parseReceivablesQuery(const char *p, const char *end, ReceivablesQuery *query)
+{
+    initReceivablesQuery(query);
+    while (p < end) {
+        const char *comma = memchr(p, ',', (size_t)(end - p));
+        const char *stop = comma ? comma : end;
+        const char *term = skipBlanks(p, stop);
+        while (stop > term && isspace((unsigned char)stop[-1])) stop--;
+        size_t n = (size_t)(stop - term);
+
+        if (n == 0) {
+            /* empty term, e.g. a trailing comma */
+        } else if (n > 4 && strncasecmp(term, "top=", 4) == 0) {
+            const char *q = parseIntField(term + 4, stop, &query->top);
+            if (!q || q != stop || query->top <= 0) return -1;
+        } else if (n > 4 && strncasecmp(term, "loc=", 4) == 0) {
+            query->locType = matchLocationType(term + 4, n - 4);
+            if (query->locType < 0) return -1;
+        } else if (n > 5 && strncasecmp(term, "owed>", 5) == 0) {
+            const char *q = parseAmountField(term + 5, stop, &query->minOwed);
+            if (!q || q != stop) return -1;
+        } else {
+            return -1;
+        }
+        p = comma ? comma + 1 : end;
+    }
+    return 0;
+}
+
+
+static inline int owedBelow(const OwedEntry *a, const OwedEntry *b)
+{
+    /* a ranks after b: it owes less, or the same and comes later by name */
+    return a->owed < b->owed || (a->owed == b->owed && a->idx > b->idx);
+}
+
+
+static void siftOwedDown(OwedEntry *heap, int n, int i)
+{
+    /* Min-heap on owedBelow: the root is the lowest-ranked entry */
+    OwedEntry e = heap[i];
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= n) break;
+        if (child + 1 < n && owedBelow(&heap[child + 1], &heap[child])) child++;
+        if (!owedBelow(&heap[child], &e)) break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = e;
+}
+
+
+static long writeTopOwed(const BoatManager *manager, OutBuffer *out,
+                         const ReceivablesQuery *query)
+{
+    /* One pass keeping the K largest balances in a bounded min-heap, whose
+       root is the one to beat; balances are read once, so payments landing
+       meanwhile cannot upset the heap order */
+    int k = query->top < manager->numBoats ? query->top : manager->numBoats;
+    OwedEntry *heap = (OwedEntry *)malloc((k > 0 ? k : 1) * sizeof(OwedEntry));
+    if (!heap) return -1;
+
+    int n = 0;
+    for (int i = 0; i < manager->numBoats && k > 0; i++) {
+        const Boat *b = manager->boats[i];
+        if (query->locType >= 0 && (int)b->locType != query->locType) continue;
+        OwedEntry e = { loadOwed(manager, b), i };
+        if (e.owed <= query->minOwed) continue;
+        if (n < k) {
+            /* Still filling: sift the new entry up */
+            int j = n++;
+            while (j > 0 && owedBelow(&e, &heap[(j - 1) / 2])) {
+                heap[j] = heap[(j - 1) / 2];
+                j = (j - 1) / 2;
+            }
+            heap[j] = e;
+        } else if (owedBelow(&heap[0], &e)) {
+            heap[0] = e;
+            siftOwedDown(heap, n, 0);
+        }
+    }
+
+    /* Heapsort in place: each lowest-ranked root moves to the back, which
+       leaves the largest balance first */
+    for (int end = n - 1; end > 0; end--) {
+        OwedEntry t = heap[0];
+        heap[0] = heap[end];
+        heap[end] = t;
+        siftOwedDown(heap, end, 0);
+    }
+    for (int i = 0; i < n; i++) {
+        outBoatLine(manager, manager->boats[heap[i].idx], out);
+    }
+    free(heap);
+    return n;
+}
+
+
+static long writeOwedByLocation(const BoatManager *manager, OutBuffer *out,
+                                const ReceivablesQuery *query)
+{
+    /* One pass in name order sorting matches into a list per location,
+       then a header and the rows of each location in turn */
+    static const char *const locNames[4] = { "slip", "land", "trailor", "storage" };
+    int *hits[4] = { NULL, NULL, NULL, NULL };
+    int numHits[4] = { 0, 0, 0, 0 }, maxHits[4] = { 0, 0, 0, 0 };
+    int64_t owed[4] = { 0, 0, 0, 0 };
+    int failed = 0;
+
+    for (int i = 0; i < manager->numBoats; i++) {
+        const Boat *b = manager->boats[i];
+        int loc = b->locType;
+        if (query->locType >= 0 && loc != query->locType) continue;
+        int64_t o = loadOwed(manager, b);
+        if (o <= query->minOwed) continue;
+        if (numHits[loc] == maxHits[loc]) {
+            int newMax = maxHits[loc] ? maxHits[loc] * 2 : 64;
+            int *grown = (int *)realloc(hits[loc], newMax * sizeof(int));
+            if (!grown) {
+                failed = 1;
+                break;
+            }
+            hits[loc]    = grown;
+            maxHits[loc] = newMax;
+        }
+        hits[loc][numHits[loc]++] = i;
+        owed[loc] += o;
+    }
+
+    long rows = 0;
+    for (int loc = 0; loc < 4 && !failed; loc++) {
+        if (query->locType >= 0 && loc != query->locType) continue;
+        /* "slip: 12 boats owe more than $500.00, $9100.00 in all" */
+        outReserve(out);
+        outStr(out, locNames[loc], strlen(locNames[loc]));
+        outStr(out, ": ", 2);
+        outInt(out, numHits[loc]);
+        const char *owe = numHits[loc] == 1 ? " boat owes more than $"
+                                            : " boats owe more than $";
+        outStr(out, owe, strlen(owe));
+        outAmount(out, query->minOwed);
+        outStr(out, ", $", 3);
+        outAmount(out, owed[loc]);
+        outStr(out, " in all\n", 8);
+        for (int h = 0; h < numHits[loc]; h++) {
+            outBoatLine(manager, manager->boats[hits[loc][h]], out);
+        }
+        rows += numHits[loc];
+    }
+    for (int loc = 0; loc < 4; loc++) free(hits[loc]);
+    return failed ? -1 : rows;
+}
+
+
+long writeReceivables(const BoatManager *manager, OutBuffer *out,
+                      const ReceivablesQuery *query)
+{
+    return query->top > 0 ? writeTopOwed(manager, out, query)
+                          : writeOwedByLocation(manager, out, query);
+}
+
+
+void printReceivables(const BoatManager *manager, const ReceivablesQuery *query)
+{
+    OutBuffer out;
+    fflush(stdout);
+    if (outOpen(&out, STDOUT_FILENO) != 0) return;
+    if (writeReceivables(manager, &out, query) < 0) {
+        static const char failed[] = "Memory allocation error.\n";
+        outStr(&out, failed, sizeof(failed) - 1);
+    }
+    outChar(&out, '\n');
+    outClose(&out);
+}
+
+
+void printSummary(const BoatManager *manager)
+{
+    static const char *const locNames[4] = { "slip", "land", "trailor", "storage" };
+    const FleetTotals *t = &manager->totals;
+    char owed[32], billed[32];
+
+    printf("%d boats, %d owing, total owed $%s\n", manager->numBoats,
+           t->numOwing, formatCents(t->totalOwed, owed, sizeof(owed)));
+    for (int loc = 0; loc < 4; loc++) {
+        printf("%10s %6d boats   Owes $%10s   Billed $%10s\n", locNames[loc],
+               t->count[loc], formatCents(t->owed[loc], owed, sizeof(owed)),
+               formatCents(t->billed[loc], billed, sizeof(billed)));
+    }
+    printf("\n");
+}
+
+
+static const char *const statOpNames[STAT_OPS] = {
+    "load", "save", "lookup", "payment", "month-end"
+};
+
+
+void printStats(const BoatManager *manager, FILE *fp)
+{
+    if (!manager->stats) {
+        fprintf(fp, "Statistics are off (start with --stats)\n\n");
+        return;
+    }
+    fprintf(fp, "%-10s %10s %8s %12s %12s %12s %12s\n", "Operation", "Count",
+            "Failed", "Mean us", "p50 us", "p99 us", "Max us");
+    for (int op = 0; op < STAT_OPS; op++) {
+        const LatencyHistogram *h = &manager->stats->ops[op];
+        double mean = h->count ? (double)h->totalNs / (double)h->count : 0.0;
+        fprintf(fp, "%-10s %10llu %8llu %12.3f %12.3f %12.3f %12.3f\n",
+                statOpNames[op], (unsigned long long)h->count,
+                (unsigned long long)h->failed, mean / 1e3,
+                (double)statPercentile(h, 50) / 1e3,
+                (double)statPercentile(h, 99) / 1e3, (double)h->maxNs / 1e3);
+    }
+    fprintf(fp, "\n");
+}
+
+
+static const char* parseLocationArgs(const char *p, const char *end,
+                                     LocationType *locType, char *detail)
+{
+    /* "<locType> <detail>" or "<locType>,<detail>", detail up to 31 chars;
+       returns NULL if malformed */
+    p = skipBlanks(p, end);
+    const char *word = p;
+    while (p < end && isalpha((unsigned char)*p)) p++;
+    int loc = matchLocationType(word, (size_t)(p - word));
+    if (loc < 0) return NULL;
+    p = skipBlanks(p, end);
+    if (p < end && *p == ',') p = skipBlanks(p + 1, end);
+
+    const char *stop = end;
+    while (stop > p && isspace((unsigned char)stop[-1])) stop--;
+    size_t n = (size_t)(stop - p);
+    if (n == 0 || n > 31) return NULL;
+    memcpy(detail, p, n);
+    detail[n] = '\0';
+    *locType = (LocationType)loc;
+    return end;
+}
+
+
+void findLocation(const BoatManager *manager)
+{
+    char line[128], detail[32];
+    LocationType locType;
+    printf("Please enter the location, e.g. slip 27                  : ");
+    if (!fgets(line, sizeof(line), stdin)) {
+        return;
+    }
+    line[strcspn(line, "\n")] = '\0';
+
+    if (!parseLocationArgs(line, line + strlen(line), &locType, detail)) {
+        printf("Invalid location %s\n", line);
+        return;
+    }
+    OutBuffer out;
+    fflush(stdout);
+    if (outOpen(&out, STDOUT_FILENO) != 0) return;
+    if (forEachBoatAt(manager, locType, detail, outBoatLine, &out) == 0) {
+        static const char none[] = "No boat at that location\n";
+        outStr(&out, none, sizeof(none) - 1);
+    }
+    outClose(&out);
+}
+
+
+static Boat* probeName(const NameIndex *index, const char *name)
+{
+    if (index->size == 0) return NULL;
+
+    /* Probe from the home slot until an empty slot ends the chain */
+    unsigned int h = hashName(name);
+    unsigned int j = h & (index->size - 1);
+    while (index->slots[j].hash != SLOT_EMPTY) {
+        if (index->slots[j].hash == h &&
+            caseInsensitiveCompare(index->slots[j].boat->name, name) == 0) {
+            return index->slots[j].boat;
+        }
+        j = (j + 1) & (index->size - 1);
+    }
+    return NULL;
+}
+
+
+Boat* findBoat(BoatManager *manager, const char *name)
+{
+    uint64_t start = statsStart(manager);
+    if (manager->lazy) loadNameBlocks(manager, name);
+    Boat *b = probeName(&manager->nameIndex, name);
+    statsStop(manager, STAT_LOOKUP, start, b == NULL);
+    return b;
+}
+
+
+int findBoatIndex(BoatManager *manager, const char *name)
+{
+    Boat *b = findBoat(manager, name);
+    if (!b) return -1;
+
+    /* The array is sorted by name: binary search for the first equal name,
+       then step over any duplicates to reach this exact record. */
+    for (int i = lowerBoundByName(manager, name); i < manager->numBoats; i++) {
+        if (manager->boats[i] == b) return i;
+    }
+    return -1;
+}
+
+
+static int comparePrefix(const char *name, const char *prefix)
+{
+    /* Order name's first strlen(prefix) characters against prefix, folded */
+    for (; *prefix; name++, prefix++) {
+        unsigned char a = foldChar(*name), b = foldChar(*prefix);
+        if (a != b) return a < b ? -1 : 1;
+    }
+    return 0;
+}
+
+
+int findBoatsByPrefix(const BoatManager *manager, const char *prefix, int *first)
+{
+    int lo = lowerBoundByName(manager, prefix);
+    int hi = manager->numBoats;
+    *first = lo;
+
+    /* First position past lo whose name no longer starts with prefix */
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (comparePrefix(manager->boats[mid]->name, prefix) <= 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo - *first;
+}
+
+
+/* State of one findBoatsFuzzy walk.  rows holds one edit-distance row per
+   depth of the implicit trie: rows[d][j] is the distance between the first
+   d letters of the current names and the first j letters of the query. */
+typedef struct {
+    const BoatManager *manager;
+    unsigned char query[MAX_NAME];
+    int   queryLen;
+    int   bound;       /* largest distance still worth visiting */
+    int  *matches;
+    int   dist[MAX_FIND_ROWS];
+    int   count;
+    int   maxMatches;
+    int   rows[MAX_NAME][MAX_NAME];
+} FuzzySearch;
+
+
+static void fuzzyKeep(FuzzySearch *s, int idx, int dist)
+{
+    /* Insert after any equally near match, so ties stay in name order */
+    int pos = s->count;
+    while (pos > 0 && s->dist[pos - 1] > dist) pos--;
+    if (pos >= s->maxMatches) return;
+    int last = s->count < s->maxMatches ? s->count : s->maxMatches - 1;
+    for (int k = last; k > pos; k--) {
+        s->matches[k] = s->matches[k - 1];
+        s->dist[k]    = s->dist[k - 1];
+    }
+    s->matches[pos] = idx;
+    s->dist[pos]    = dist;
+    if (s->count < s->maxMatches) s->count++;
+
+    /* Once full, only strictly nearer names can get in */
+    if (s->count == s->maxMatches) s->bound = s->dist[s->count - 1] - 1;
+}
+
+
+static void fuzzyWalk(FuzzySearch *s, int lo, int hi, int depth)
+{
+    Boat *const *boats = s->manager->boats;
+    const int *row = s->rows[depth];
+    int n = s->queryLen;
+
+    /* Names that end here sort first in the range */
+    while (lo < hi && boats[lo]->name[depth] == '\0') {
+        if (row[n] <= s->bound) fuzzyKeep(s, lo, row[n]);
+        lo++;
+    }
+    if (depth + 1 >= MAX_NAME) return;
+
+    /* Every other name continues with a letter; each letter's names are a
+       contiguous run, found by binary search on that letter alone */
+    while (lo < hi) {
+        unsigned char c = foldChar(boats[lo]->name[depth]);
+        int runLo = lo + 1, runHi = hi;
+        while (runLo < runHi) {
+            int mid = runLo + (runHi - runLo) / 2;
+            if (foldChar(boats[mid]->name[depth]) <= c) {
+                runLo = mid + 1;
+            } else {
+                runHi = mid;
+            }
+        }
+
+        int *next = s->rows[depth + 1];
+        int best = next[0] = row[0] + 1;
+        for (int j = 1; j <= n; j++) {
+            int d = row[j - 1] + (s->query[j - 1] != c);
+            if (row[j] + 1 < d) d = row[j] + 1;
+            if (next[j - 1] + 1 < d) d = next[j - 1] + 1;
+            next[j] = d;
+            if (d < best) best = d;
+        }
+        if (best <= s->bound) fuzzyWalk(s, lo, runLo, depth + 1);
+        lo = runLo;
+    }
+}
+
+
+int findBoatsFuzzy(const BoatManager *manager, const char *name, int maxEdits,
+                   int *matches, int maxMatches)
+{
+    FuzzySearch *s = (FuzzySearch *)malloc(sizeof(FuzzySearch));
+    if (!s) return 0;
+    if (maxMatches > (int)(sizeof(s->dist) / sizeof(s->dist[0]))) {
+        maxMatches = (int)(sizeof(s->dist) / sizeof(s->dist[0]));
+    }
+    s->manager    = manager;
+    s->bound      = maxEdits;
+    s->matches    = matches;
+    s->count      = 0;
+    s->maxMatches = maxMatches;
+    s->queryLen   = 0;
+    while (name[s->queryLen] && s->queryLen < MAX_NAME - 1) {
+        s->query[s->queryLen] = foldChar(name[s->queryLen]);
+        s->queryLen++;
+    }
+    for (int j = 0; j <= s->queryLen; j++) s->rows[0][j] = j;
+
+    if (maxMatches > 0 && manager->numBoats > 0) {
+        fuzzyWalk(s, 0, manager->numBoats, 0);
+    }
+    int count = s->count;
+    free(s);
+    return count;
+}
+
+
+static int suggestNames(const BoatManager *manager, const char *name,
+                        int *matches, int maxMatches)
+{
+    /* Boats the name is the start of, else the nearest few names */
+    int first, count = findBoatsByPrefix(manager, name, &first);
+    if (name[0] && count > 0) {
+        if (count > maxMatches) count = maxMatches;
+        for (int k = 0; k < count; k++) matches[k] = first + k;
+        return count;
+    }
+    int edits = strlen(name) <= 4 ? 1 : MAX_FUZZY_EDITS;
+    return findBoatsFuzzy(manager, name, edits, matches, maxMatches);
+}
+
+
+static void printNoSuchBoat(const BoatManager *manager, const char *name)
+{
+    int matches[MAX_SUGGESTIONS];
+    int count = suggestNames(manager, name, matches, MAX_SUGGESTIONS);
+    printf("No boat with that name\n");
+    if (count > 0) {
+        printf("Did you mean");
+        for (int k = 0; k < count; k++) {
+            printf("%s %s", k ? "," : "", manager->boats[matches[k]]->name);
+        }
+        printf("?\n");
+    }
+}
+
+
+void findByName(const BoatManager *manager)
+{
+    char name[MAX_NAME];
+    printf("Please enter the boat name or the start of it            : ");
+    if (!fgets(name, sizeof(name), stdin)) {
+        return;
+    }
+    name[strcspn(name, "\n")] = '\0';
+    if (name[0] == '\0') return;
+
+    int matches[MAX_FIND_ROWS];
+    int first, total = findBoatsByPrefix(manager, name, &first);
+    int count = suggestNames(manager, name, matches, MAX_FIND_ROWS);
+    if (count == 0) {
+        printf("No boat with a name like that\n");
+        return;
+    }
+    if (total == 0) printf("No boat with that name; the nearest are\n");
+
+    OutBuffer out;
+    fflush(stdout);
+    if (outOpen(&out, STDOUT_FILENO) != 0) return;
+    for (int k = 0; k < count; k++) {
+        outBoatLine(manager, manager->boats[matches[k]], &out);
+    }
+    outClose(&out);
+    if (total > count) {
+        printf("... and %d more (i name=%s lists them all)\n", total - count, name);
+    }
+}
+
+
+void addBoat(BoatManager *manager)
+{
+    /* Prompt for CSV-like line, e.g. "Brooks,34,trailor,AAR666,99.00" */
+    char line[512];
+    printf("Please enter the boat data in CSV format                 : ");
+    if (!fgets(line, sizeof(line), stdin)) {
+        /* EOF or input error */
+        return;
+    }
+    /* Remove trailing newline if any */
+    line[strcspn(line, "\n")] = '\0';
+
+    /* We'll parse: name, length, locStr, detail, owed */
+    CsvRow row;
+    if (!parseCsvRow(line, line + strlen(line), &row)) {
+        printf("Invalid CSV format.\n");
+        return;
+    }
+
+    const Boat *occupant;
+    if (!addBoatRow(manager, &row, &occupant)) {
+        if (occupant) {
+            printf("That %s is already taken by %s.\n",
+                   occupant->locType == SLIP ? "slip" : "storage space",
+                   occupant->name);
+        } else {
+            printf("Memory allocation error.\n");
+        }
+    }
+}
+
+
+Boat* addBoatRow(BoatManager *manager, const CsvRow *row, const Boat **occupant)
+{
+    loadRemainingBoats(manager);  /* the space may be taken by any boat */
+    Boat *b = createBoatFromRow(manager, row);
+    if (occupant) *occupant = NULL;
+    if (!b) {
+        return NULL;
+    }
+
+    /* One boat per slip or storage space: an O(1) look in the location index */
+    if (b->locType == SLIP || b->locType == STORAGE) {
+        const int *head = locationChain(&manager->locations, b->locType, &b->detail, 0);
+        for (int id = head ? *head : -1; id >= 0; id = manager->arena.locNext[id]) {
+            const Boat *other = arenaBoat(&manager->arena, id);
+            if (sameLocation(other, b->locType, &b->detail)) {
+                if (occupant) *occupant = other;
+                releaseBoat(manager, b);
+                return NULL;
+            }
+        }
+    }
+
+    /* Insert the boat at its alphabetical position. */
+    if (insertBoat(manager, b) != 0) {
+        releaseBoat(manager, b);
+        return NULL;
+    }
+    journalRecord(manager, JOURNAL_ADD, b, 0);
+    return b;
+}
+
+
+void removeBoat(BoatManager *manager)
+{
+    /* Prompt user for boat name */
+    char name[128];
+    printf("Please enter the boat name                               : ");
+    if (!fgets(name, sizeof(name), stdin)) {
+        return;
+    }
+    name[strcspn(name, "\n")] = '\0';
+
+    int idx = findBoatIndex(manager, name);
+    if (idx < 0) {
+        printNoSuchBoat(manager, name);
+        return;
+    }
+    removeBoatAt(manager, idx);
+}
+
+
+void removeBoatAt(BoatManager *manager, int idx)
+{
+    Boat *b = manager->boats[idx];
+    journalRecord(manager, JOURNAL_REMOVE, b, 0);
+
+    /* Drop it from the totals and the indexes, then give the record back to
+       the arena */
+    countBoat(manager, b, -1);
+    nameIndexRemove(&manager->nameIndex, b);
+    locationIndexRemove(manager, b);
+    releaseBoat(manager, b);
+
+    /* Close the gap; the remaining boats are still in sorted order */
+    memmove(&manager->boats[idx], &manager->boats[idx + 1],
+            (manager->numBoats - idx - 1) * sizeof(Boat*));
+    manager->numBoats--;
+    markReshaped(manager);
+    compactStrings(manager);
+}
+
+
+void acceptPayment(BoatManager *manager)
+{
+    char name[128];
+    printf("Please enter the boat name                               : ");
+    if (!fgets(name, sizeof(name), stdin)) {
+        return;
+    }
+    name[strcspn(name, "\n")] = '\0';
+
+    Boat *b = findBoat(manager, name);
+    if (!b) {
+        printNoSuchBoat(manager, name);
+        return;
+    }
+
+    /* Read the whole answer line, so nothing is left behind for the menu */
+    char amount[128];
+    int64_t payment;
+    printf("Please enter the amount to be paid                       : ");
+    if (!fgets(amount, sizeof(amount), stdin) ||
+        !parseAmountField(amount, amount + strlen(amount), &payment)) {
+        return;
+    }
+
+    /* Check if payment exceeds amount owed */
+    if (postPayment(manager, b, payment) != 0) {
+        char owed[32];
+        printf("That is more than the amount owed, $%s\n",
+               formatCents(*boatOwed(manager, b), owed, sizeof(owed)));
+    }
+}
+
+
+int postPayment(BoatManager *manager, Boat *b, int64_t payment)
+{
+    /* Two payments on one boat must not both pass the check: on a shared
+       manager the check and the update happen under the boat's stripe */
+    uint64_t start = statsStart(manager);
+    pthread_mutex_t *stripe = NULL;
+    if (manager->locks) {
+        stripe = &manager->locks->stripes[hashName(b->name) & (BALANCE_STRIPES - 1)];
+        pthread_mutex_lock(stripe);
+    }
+    int refused = payment > *boatOwed(manager, b);
+    if (!refused) applyPayment(manager, b, payment);
+    if (stripe) pthread_mutex_unlock(stripe);
+    statsStop(manager, STAT_PAYMENT, start, refused);
+    return refused ? -1 : 0;
+}
+
+
+void applyPayment(BoatManager *manager, Boat *b, int64_t payment)
+{
+    /* Subtract the payment, keeping the running totals in step */
+    FleetTotals *t = &manager->totals;
+    int64_t *owed = boatOwed(manager, b);
+    int64_t before = *owed, after = before - payment;
+    __atomic_store_n(owed, after, __ATOMIC_RELAXED);
+    markBoatDirty(manager, b);
+
+    if (manager->locks) pthread_mutex_lock(&manager->locks->totalsLock);
+    t->numOwing += (after != 0) - (before != 0);
+    t->owed[b->locType] -= payment;
+    t->totalOwed        -= payment;
+    journalRecord(manager, JOURNAL_PAYMENT, b, payment);
+    if (manager->locks) pthread_mutex_unlock(&manager->locks->totalsLock);
+}
+
+
+void monthlyUpdate(BoatManager *manager)
+{
+    billMonths(manager, 1, NULL);
+}
+
+
+static const RatePeriod* ratePeriods(const BoatManager *manager,
+                                     RatePeriod *fallback, int *count)
+{
+    /* The manager's schedule, or one open-ended period of MONTH_* rates */
+    if (manager->rates && manager->rates->numPeriods > 0) {
+        *count = manager->rates->numPeriods;
+        return manager->rates->periods;
+    }
+    static const int64_t builtIn[4] = {
+        MONTH_SLIP, MONTH_LAND, MONTH_TRAILOR, MONTH_STORAGE
+    };
+    fallback->fromMonth = 0;
+    setFlatRates(&fallback->table, builtIn);
+    *count = 1;
+    return fallback;
+}
+
+
+int billMonths(BoatManager *manager, int months, BillingTotals *totals)
+{
+    if (months < 1 || months > MAX_BILL_MONTHS) return -1;
+
+    /* The period in effect now; later ones are price changes announced
+       ahead and must wait for their month.  The first period starts at
+       month 0, so there always is one. */
+    RatePeriod fallback;
+    int count;
+    const RatePeriod *periods = ratePeriods(manager, &fallback, &count);
+    time_t now = time(NULL);
+    struct tm local;
+    int current = count - 1;
+    if (localtime_r(&now, &local) != NULL) {
+        int thisMonth = (local.tm_year + 1900) * 12 + local.tm_mon;
+        while (current > 0 && periods[current].fromMonth > thisMonth) current--;
+    }
+
+    /* N months at one rate is N times the charge, so bill it as one pass */
+    const RateTable *rates = &periods[current].table;
+    RateTable table;
+    for (int loc = 0; loc < 4; loc++) {
+        for (int n = 0; n < RATE_LENGTHS; n++) {
+            table.perFoot[loc][n] = rates->perFoot[loc][n] * months;
+        }
+    }
+    billRates(manager, &table, totals);
+    return 0;
+}
+
+
+int billDateRange(BoatManager *manager, int firstMonth, int lastMonth,
+                  BillingTotals *totals)
+{
+    if (lastMonth < firstMonth || lastMonth - firstMonth >= MAX_BILL_MONTHS) {
+        return -1;
+    }
+
+    /* Total each rate period's share of the range (work per rate change,
+       not per month), then bill the sum in a single pass */
+    RatePeriod fallback;
+    int count;
+    const RatePeriod *periods = ratePeriods(manager, &fallback, &count);
+    RateTable table;
+    memset(&table, 0, sizeof(table));
+    for (int i = 0; i < count; i++) {
+        int lo = firstMonth, hi = lastMonth;
+        if (i > 0 && periods[i].fromMonth > lo) lo = periods[i].fromMonth;
+        if (i + 1 < count && periods[i + 1].fromMonth - 1 < hi) {
+            hi = periods[i + 1].fromMonth - 1;
+        }
+        if (lo > hi) continue;
+        for (int loc = 0; loc < 4; loc++) {
+            for (int n = 0; n < RATE_LENGTHS; n++) {
+                table.perFoot[loc][n] += periods[i].table.perFoot[loc][n] * (hi - lo + 1);
+            }
+        }
+    }
+    billRates(manager, &table, totals);
+    return 0;
+}
+
+
+/* One worker's share of billRates: boat slots [begin, end) */
+typedef struct {
+    const RateTable     *table;
+    const int           *length;
+    const unsigned char *locType;
+    int64_t             *owed;
+    int                  begin, end;
+    int64_t              billed[4];   /* this slice's charges, per location */
+    int                  owingDelta;  /* boats that started or stopped owing */
+} BillSlice;
+
+
+static void* billSliceThread(void *arg)
+{
+    /* Add the charges based on boat length and location.  This sweeps the
+       arena's hot-field arrays rather than chasing boat pointers, and the
+       rate is a table lookup (the length clamp is a select, not a branch).
+       The per-location sums are kept as four selects rather than an
+       indexed add, so the loop has no branches and the compiler can
+       vectorize it.  Amounts are whole cents, so the sum is exact however
+       many months accrue.  Unused slots have length 0 and add 0. */
+    BillSlice *s = (BillSlice *)arg;
+    const int *restrict length = s->length;
+    const unsigned char *restrict loc = s->locType;
+    int64_t *restrict owed = s->owed;
+    const int64_t (*rate)[RATE_LENGTHS] = s->table->perFoot;
+    int64_t slip = 0, land = 0, trailor = 0, storage = 0;
+    int owingDelta = 0;
+
+    for (int i = s->begin; i < s->end; i++) {
+        int n = length[i];
+        unsigned tier = (unsigned)n < RATE_LENGTHS ? (unsigned)n : RATE_LENGTHS - 1;
+        unsigned l = loc[i] & 3;
+        int64_t charge = rate[l][tier] * n;
+        int64_t before = owed[i];
+        owed[i] = before + charge;
+        owingDelta += (before + charge != 0) - (before != 0);
+        slip    += l == SLIP    ? charge : 0;
+        land    += l == LAND    ? charge : 0;
+        trailor += l == TRAILOR ? charge : 0;
+        storage += l == STORAGE ? charge : 0;
+    }
+    s->billed[SLIP]    = slip;
+    s->billed[LAND]    = land;
+    s->billed[TRAILOR] = trailor;
+    s->billed[STORAGE] = storage;
+    s->owingDelta      = owingDelta;
+    return NULL;
+}
+
+
+void billRates(BoatManager *manager, const RateTable *table,
+               BillingTotals *totals)
+{
+    loadRemainingBoats(manager);  /* every balance changes */
+
+    /* Disjoint slices, one per worker, so no slot or counter is shared */
+    uint64_t start = statsStart(manager);
+    int slots = manager->arena.numSlabs * BOAT_SLAB_SIZE;
+    int numSlices = manager->billThreads;
+    if (numSlices > MAX_THREADS) numSlices = MAX_THREADS;
+    if (numSlices > slots / MIN_BILL_SLICE) numSlices = slots / MIN_BILL_SLICE;
+    if (numSlices < 1) numSlices = 1;
+
+    BillSlice slices[MAX_THREADS];
+    for (int t = 0; t < numSlices; t++) {
+        slices[t].table   = table;
+        slices[t].length  = manager->arena.length;
+        slices[t].locType = manager->arena.locType;
+        slices[t].owed    = manager->arena.amountOwed;
+        slices[t].begin   = (int)((int64_t)slots * t / numSlices);
+        slices[t].end     = (int)((int64_t)slots * (t + 1) / numSlices);
+    }
+    runParallel(billSliceThread, slices, sizeof(BillSlice), numSlices);
+
+    /* Reduce the per-thread sums only after every worker has finished */
+    BillingTotals sum;
+    memset(&sum, 0, sizeof(sum));
+    for (int t = 0; t < numSlices; t++) {
+        for (int loc = 0; loc < 4; loc++) {
+            sum.billed[loc] += slices[t].billed[loc];
+        }
+        sum.owingDelta += slices[t].owingDelta;
+    }
+    FleetTotals *fleet = &manager->totals;
+    for (int loc = 0; loc < 4; loc++) {
+        fleet->owed[loc]   += sum.billed[loc];
+        fleet->billed[loc] += sum.billed[loc];
+        fleet->totalOwed   += sum.billed[loc];
+    }
+    fleet->numOwing += sum.owingDelta;
+    markReshaped(manager);
+    if (totals) *totals = sum;
+    if (manager->journal) {
+        journalAppend(manager->journal, JOURNAL_MONTH,
+                      (const unsigned char *)table, sizeof(RateTable));
+    }
+    statsStop(manager, STAT_MONTH_END, start, 0);
+}
+
+static const char* parseMonthField(const char *p, const char *end, int *month)
+{
+    /* "YYYY-MM" as year * 12 + month - 1; returns NULL if malformed */
+    int year = 0, mm = 0, digits = 0;
+    p = skipBlanks(p, end);
+    while (p < end && *p >= '0' && *p <= '9' && digits < 4) {
+        year = year * 10 + (*p++ - '0');
+        digits++;
+    }
+    if (digits != 4 || p == end || *p++ != '-') return NULL;
+    for (digits = 0; p < end && *p >= '0' && *p <= '9' && digits < 2; digits++) {
+        mm = mm * 10 + (*p++ - '0');
+    }
+    if (digits == 0 || mm < 1 || mm > 12) return NULL;
+    *month = year * 12 + mm - 1;
+    return p;
+}
+
+
+static int billPeriodArgs(BoatManager *manager, const char *p, const char *end,
+                          BillingTotals *totals)
+{
+    /* Month-end arguments shared by the menu and batch commands: nothing
+       (one month), a month count, or a "YYYY-MM,YYYY-MM" range (a blank
+       works as the separator too).  Returns 0 if billed, -1 if malformed. */
+    int first, last, months;
+    p = skipBlanks(p, end);
+    if (p == end) return billMonths(manager, 1, totals);
+
+    const char *q = parseMonthField(p, end, &first);
+    if (q) {
+        q = skipBlanks(q, end);
+        if (q < end && *q == ',') q++;
+        q = parseMonthField(q, end, &last);
+        if (!q || skipBlanks(q, end) != end) return -1;
+        return billDateRange(manager, first, last, totals);
+    }
+    q = parseIntField(p, end, &months);
+    if (!q || skipBlanks(q, end) != end) return -1;
+    return billMonths(manager, months, totals);
+}
+
+
+static int parseRateLine(RateSchedule *schedule, const char *p, const char *end)
+{
+    /* One line of a rate file (see loadRateSchedule); returns 0 if malformed */
+    p = skipBlanks(p, end);
+    const char *word = p;
+    while (p < end && isalpha((unsigned char)*p)) p++;
+    size_t wordLen = (size_t)(p - word);
+
+    if (wordLen == 4 && strncasecmp(word, "from", 4) == 0) {
+        int month;
+        const RatePeriod *last = &schedule->periods[schedule->numPeriods - 1];
+        p = parseMonthField(p, end, &month);
+        if (!p || skipBlanks(p, end) != end) return 0;
+        if (month <= last->fromMonth) return 0;  /* periods must ascend */
+        RatePeriod *periods = (RatePeriod *)realloc(schedule->periods,
+                                  (schedule->numPeriods + 1) * sizeof(RatePeriod));
+        if (!periods) return 0;
+        schedule->periods = periods;
+        periods[schedule->numPeriods] = periods[schedule->numPeriods - 1];
+        periods[schedule->numPeriods].fromMonth = month;
+        schedule->numPeriods++;
+        return 1;
+    }
+
+    int loc = matchLocationType(word, wordLen);
+    if (loc < 0) return 0;
+
+    /* Optional "<min>-[<max>]" length tier before the rate */
+    int lo = 0, hi = RATE_LENGTHS - 1;
+    const char *q = parseIntField(p, end, &lo);
+    if (q && q < end && *q == '-') {
+        /* "40-" is open-ended; "40-60" must have the max right after '-' */
+        p = q + 1;
+        if (p < end && isdigit((unsigned char)*p)) p = parseIntField(p, end, &hi);
+        if (hi > RATE_LENGTHS - 1) hi = RATE_LENGTHS - 1;
+        if (lo < 0 || lo > hi) return 0;
+    } else {
+        lo = 0;
+    }
+
+    int64_t cents;
+    p = parseAmountField(p, end, &cents);
+    if (!p || cents < 0 || skipBlanks(p, end) != end) return 0;
+    RateTable *table = &schedule->periods[schedule->numPeriods - 1].table;
+    for (int n = lo; n <= hi; n++) {
+        table->perFoot[loc][n] = cents;
+    }
+    return 1;
+}
+
+
+int loadRateSchedule(RateSchedule *schedule, const char *filename)
+{
+    static const int64_t builtIn[4] = {
+        MONTH_SLIP, MONTH_LAND, MONTH_TRAILOR, MONTH_STORAGE
+    };
+    schedule->numPeriods = 0;
+    schedule->periods = (RatePeriod *)malloc(sizeof(RatePeriod));
+    if (!schedule->periods) return -1;
+    schedule->periods[0].fromMonth = 0;
+    setFlatRates(&schedule->periods[0].table, builtIn);
+    schedule->numPeriods = 1;
+
+    MappedFile mf;
+    if (openMappedFile(&mf, filename) != 0) {
+        fprintf(stderr, "Unable to open rate file '%s'\n", filename);
+        freeRateSchedule(schedule);
+        return -1;
+    }
+
+    const char *p = mf.data, *end = mf.data + mf.size;
+    int lineNo = 0;
+    while (p < end) {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        const char *stop = nl ? nl : end;
+        const char *hash = memchr(p, '#', (size_t)(stop - p));
+        const char *lineEnd = hash ? hash : stop;
+        while (lineEnd > p && (lineEnd[-1] == '\r' || isspace((unsigned char)lineEnd[-1]))) {
+            lineEnd--;
+        }
+        lineNo++;
+        if (skipBlanks(p, lineEnd) != lineEnd &&
+            !parseRateLine(schedule, p, lineEnd)) {
+            fprintf(stderr, "%s:%d: invalid rate line\n", filename, lineNo);
+            closeMappedFile(&mf);
+            freeRateSchedule(schedule);
+            return -1;
+        }
+        p = nl ? nl + 1 : end;
+    }
+    closeMappedFile(&mf);
+    return 0;
+}
+
+
+void freeRateSchedule(RateSchedule *schedule)
+{
+    free(schedule->periods);
+    schedule->periods    = NULL;
+    schedule->numPeriods = 0;
+}
+
+
+static void outResultStart(OutBuffer *out, long tag)
+{
+    outReserve(out);
+    if (tag > 0) {
+        outInt(out, tag);
+        outChar(out, ' ');
+    }
+}
+
+
+static int outResult(OutBuffer *out, long tag, const char *text)
+{
+    /* One result line; returns 1 for an error result, 0 for OK */
+    outResultStart(out, tag);
+    outStr(out, text, strlen(text));
+    outChar(out, '\n');
+    return text[0] == 'E';
+}
+
+
+static int copyField(const char *p, const char *end, char *buf, size_t size)
+{
+    /* Copy [p, end) into a NUL-terminated buf, truncating to fit; returns
+       0 if it is empty */
+    p = skipBlanks(p, end);
+    while (end > p && (end[-1] == '\r' || end[-1] == '\n')) end--;
+    size_t n = (size_t)(end - p);
+    if (n == 0) return 0;
+    if (n > size - 1) n = size - 1;
+    memcpy(buf, p, n);
+    buf[n] = '\0';
+    return 1;
+}
+
+
+static int copyNameField(const char *p, const char *end, char *name)
+{
+    return copyField(p, end, name, MAX_NAME);
+}
+
+
+/* Where forEachBoatAt's visitor appends names for the batch L command */
+typedef struct {
+    OutBuffer *out;
+    int        count;
+} BatchNames;
+
+
+static void outBoatName(const BoatManager *manager, const Boat *b, void *ctx)
+{
+    (void)manager;
+    BatchNames *names = (BatchNames *)ctx;
+    outReserve(names->out);
+    outChar(names->out, names->count++ ? ',' : ' ');
+    outStr(names->out, b->name, b->nameLen);
+}
+
+
+static void outBilledResult(OutBuffer *out, long tag, const BillingTotals *totals)
+{
+    /* "OK billed <total> <slip> <land> <trailor> <storage>" */
+    int64_t sum = 0;
+    for (int loc = 0; loc < 4; loc++) sum += totals->billed[loc];
+    outResultStart(out, tag);
+    outStr(out, "OK billed ", 10);
+    outAmount(out, sum);
+    for (int loc = 0; loc < 4; loc++) {
+        outChar(out, ' ');
+        outAmount(out, totals->billed[loc]);
+    }
+    outChar(out, '\n');
+}
+
+
+static void outTotalsResult(OutBuffer *out, long tag, long numBoats,
+                            const FleetTotals *t)
+{
+    /* "OK boats <n> owing <n> owed <total>" and a group per location */
+    static const char *const locNames[4] = {
+        "slip", "land", "trailor", "storage"
+    };
+    outResultStart(out, tag);
+    outStr(out, "OK boats ", 9);
+    outInt(out, numBoats);
+    outStr(out, " owing ", 7);
+    outInt(out, t->numOwing);
+    outStr(out, " owed ", 6);
+    outAmount(out, t->totalOwed);
+    for (int loc = 0; loc < 4; loc++) {
+        outReserve(out);
+        outChar(out, ' ');
+        outStr(out, locNames[loc], strlen(locNames[loc]));
+        outChar(out, ' ');
+        outInt(out, t->count[loc]);
+        outChar(out, ' ');
+        outAmount(out, t->owed[loc]);
+        outChar(out, ' ');
+        outAmount(out, t->billed[loc]);
+    }
+    outChar(out, '\n');
+}
+
+
+static int runCommand(BoatManager *manager, const char *line, size_t len,
+                      OutBuffer *out, long tag)
+{
+    const char *end = line + len;
+    const char *p = skipBlanks(line, end);
+    if (p == end || *p == '#') return -1;
+
+    char cmd = (char)tolower((unsigned char)*p);
+    const char *args = p + 1;
+    if (args < end && *args == ',') args++;
+
+    /* Lookups by name read a lazy file a block at a time; listings,
+       summaries and searches need every boat */
+    if (manager->lazy && strchr("islfo", cmd)) loadRemainingBoats(manager);
+
+    char name[MAX_NAME];
+    switch (cmd) {
+        case 'a': {
+            CsvRow row;
+            if (!parseCsvRow(args, end, &row)) {
+                return outResult(out, tag, "ERR invalid boat data");
+            }
+            const Boat *occupant;
+            if (!addBoatRow(manager, &row, &occupant)) {
+                if (!occupant) return outResult(out, tag, "ERR out of memory");
+                outResultStart(out, tag);
+                outStr(out, "ERR space taken by ", 19);
+                outStr(out, occupant->name, occupant->nameLen);
+                outChar(out, '\n');
+                return 1;
+            }
+            return outResult(out, tag, "OK");
+        }
+        case 'r': {
+            int idx = copyNameField(args, end, name) ? findBoatIndex(manager, name) : -1;
+            if (idx < 0) {
+                return outResult(out, tag, "ERR no boat with that name");
+            }
+            removeBoatAt(manager, idx);
+            return outResult(out, tag, "OK");
+        }
+        case 'p': {
+            const char *comma = memchr(args, ',', end - args);
+            int64_t payment;
+            if (!comma || !copyNameField(args, comma, name) ||
+                !parseAmountField(comma + 1, end, &payment)) {
+                return outResult(out, tag, "ERR expected P,<name>,<amount>");
+            }
+            Boat *b = findBoat(manager, name);
+            if (!b) {
+                return outResult(out, tag, "ERR no boat with that name");
+            }
+            if (postPayment(manager, b, payment) != 0) {
+                outResultStart(out, tag);
+                outStr(out, "ERR more than the amount owed ", 30);
+                outAmount(out, *boatOwed(manager, b));
+                outChar(out, '\n');
+                return 1;
+            }
+            return outResult(out, tag, "OK");
+        }
+        case 'm': {
+            BillingTotals totals;
+            if (billPeriodArgs(manager, args, end, &totals) != 0) {
+                return outResult(out, tag,
+                                 "ERR expected M[,<months>|,<YYYY-MM>,<YYYY-MM>]");
+            }
+            outBilledResult(out, tag, &totals);
+            return 0;
+        }
+        case 's': {
+            /* A copy, so payments on other threads are not held up */
+            FleetTotals copy;
+            if (manager->locks) pthread_mutex_lock(&manager->locks->totalsLock);
+            copy = manager->totals;
+            if (manager->locks) pthread_mutex_unlock(&manager->locks->totalsLock);
+            outTotalsResult(out, tag, manager->numBoats, &copy);
+            return 0;
+        }
+        case 'l': {
+            LocationType locType;
+            char detail[32];
+            if (!parseLocationArgs(args, end, &locType, detail)) {
+                return outResult(out, tag, "ERR expected L,<locType>,<detail>");
+            }
+            /* "OK <count>" then the boats' names, comma-separated */
+            int count = forEachBoatAt(manager, locType, detail, NULL, NULL);
+            outResultStart(out, tag);
+            outStr(out, "OK ", 3);
+            outInt(out, count);
+            BatchNames names = { out, 0 };
+            forEachBoatAt(manager, locType, detail, outBoatName, &names);
+            outChar(out, '\n');
+            return 0;
+        }
+        case 'f': {
+            if (!copyNameField(args, end, name)) {
+                return outResult(out, tag, "ERR expected F,<name or prefix>");
+            }
+            /* "OK <count>" then the names, as for L */
+            int matches[MAX_FIND_ROWS];
+            int count = suggestNames(manager, name, matches, MAX_FIND_ROWS);
+            outResultStart(out, tag);
+            outStr(out, "OK ", 3);
+            outInt(out, count);
+            BatchNames names = { out, 0 };
+            for (int k = 0; k < count; k++) {
+                outBoatName(manager, manager->boats[matches[k]], &names);
+            }
+            outChar(out, '\n');
+            return 0;
+        }
+        case 't': {
+            /* "OK" then "<op> <count> <failed> <mean> <p50> <p99> <max>",
+               latencies in ns, for each measured operation */
+            if (!manager->stats) {
+                return outResult(out, tag, "ERR statistics are off");
+            }
+            outResultStart(out, tag);
+            outStr(out, "OK", 2);
+            for (int op = 0; op < STAT_OPS; op++) {
+                const LatencyHistogram *h = &manager->stats->ops[op];
+                outReserve(out);
+                outChar(out, ' ');
+                outStr(out, statOpNames[op], strlen(statOpNames[op]));
+                outChar(out, ' ');
+                outInt(out, (long long)h->count);
+                outChar(out, ' ');
+                outInt(out, (long long)h->failed);
+                outChar(out, ' ');
+                outInt(out, h->count ? (long long)(h->totalNs / h->count) : 0);
+                outChar(out, ' ');
+                outInt(out, (long long)statPercentile(h, 50));
+                outChar(out, ' ');
+                outInt(out, (long long)statPercentile(h, 99));
+                outChar(out, ' ');
+                outInt(out, (long long)h->maxNs);
+            }
+            outChar(out, '\n');
+            return 0;
+        }
+        case 'b': {
+            char file[MAX_PATH_LEN], rejects[MAX_PATH_LEN + 16];
+            const char *comma = memchr(args, ',', end - args);
+            if (!copyField(args, comma ? comma : end, file, sizeof(file))) {
+                return outResult(out, tag, "ERR expected B,<file>[,<rejects>]");
+            }
+            if (!comma || !copyField(comma + 1, end, rejects, sizeof(rejects))) {
+                snprintf(rejects, sizeof(rejects), "%s.rejects", file);
+            }
+            RemittanceResult result;
+            if (postRemittance(manager, file, rejects, &result) != 0 &&
+                result.posted == 0) {
+                return outResult(out, tag, "ERR unable to post remittance file");
+            }
+            outResultStart(out, tag);
+            outStr(out, "OK posted ", 10);
+            outInt(out, result.posted);
+            outStr(out, " total ", 7);
+            outAmount(out, result.amount);
+            outStr(out, " rejected ", 10);
+            outInt(out, result.rejected);
+            outChar(out, '\n');
+            return 0;
+        }
+        case 'i': {
+            /* The rows go into the result stream itself, then a blank line */
+            InventoryFilter filter;
+            if (parseInventoryFilter(args, end, &filter) != 0) {
+                return outResult(out, tag, "ERR invalid inventory filter");
+            }
+            writeInventory(manager, out, &filter);
+            outReserve(out);
+            outChar(out, '\n');
+            return outResult(out, tag, "OK");
+        }
+        case 'o': {
+            /* The report's lines, a blank line, then the result, as for I */
+            ReceivablesQuery query;
+            if (parseReceivablesQuery(args, end, &query) != 0) {
+                return outResult(out, tag, "ERR invalid receivables query");
+            }
+            if (writeReceivables(manager, out, &query) < 0) {
+                return outResult(out, tag, "ERR out of memory");
+            }
+            outReserve(out);
+            outChar(out, '\n');
+            return outResult(out, tag, "OK");
+        }
+        default:
+            return outResult(out, tag, "ERR invalid command");
+    }
+}
+
+
+static int exclusiveCommand(const char *line, size_t len)
+{
+    /* Adding, removing and billing reshape the fleet; the rest only read
+       it (a payment changes one balance, under its own stripe) */
+    const char *p = skipBlanks(line, line + len);
+    return p < line + len && *p && strchr("aArRmM", *p) != NULL;
+}
+
+
+int executeCommand(BoatManager *manager, const char *line, size_t len,
+                   OutBuffer *out, long tag)
+{
+    lockFleet(manager, exclusiveCommand(line, len));
+    int result = runCommand(manager, line, len, out, tag);
+    unlockFleet(manager);
+    return result;
+}
+
+
+static int lineReaderOpen(LineReader *lr, int fd)
+{
+    lr->fd    = fd;
+    lr->start = lr->end = 0;
+    lr->eof   = 0;
+    lr->buf   = (char *)malloc(LINE_BUF_SIZE);
+    return lr->buf ? 0 : -1;
+}
+
+
+static int lineReaderNext(LineReader *lr, const char **line, size_t *len)
+{
+    /* Returns 1 with the next line (without its newline), 0 at end of input.
+       Lines longer than the buffer are cut into buffer-sized pieces. */
+    for (;;) {
+        char *nl = memchr(lr->buf + lr->start, '\n', lr->end - lr->start);
+        if (nl || (lr->eof && lr->start < lr->end) ||
+            (lr->start == 0 && lr->end == LINE_BUF_SIZE)) {
+            size_t stop = nl ? (size_t)(nl - lr->buf) : lr->end;
+            *line = lr->buf + lr->start;
+            *len  = stop - lr->start;
+            lr->start = nl ? stop + 1 : stop;
+            return 1;
+        }
+        if (lr->eof) return 0;
+
+        /* Slide the partial line to the front and read more behind it */
+        memmove(lr->buf, lr->buf + lr->start, lr->end - lr->start);
+        lr->end  -= lr->start;
+        lr->start = 0;
+        ssize_t n = read(lr->fd, lr->buf + lr->end, LINE_BUF_SIZE - lr->end);
+        if (n <= 0) {
+            lr->eof = 1;
+        } else {
+            lr->end += (size_t)n;
+        }
+    }
+}
+
+
+static int runCommandFile(const char *filename,
+                          int (*execute)(void *, const char *, size_t, OutBuffer *, long),
+                          void *ctx)
+{
+    /* runBatch for any command set: execute answers like executeCommand */
+    int fd = strcmp(filename, "-") == 0 ? STDIN_FILENO : open(filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Unable to read batch file '%s'\n", filename);
+        return -1;
+    }
+
+    LineReader lr;
+    OutBuffer out;
+    if (lineReaderOpen(&lr, fd) != 0 || outOpen(&out, STDOUT_FILENO) != 0) {
+        free(lr.buf);
+        if (fd != STDIN_FILENO) close(fd);
+        return -1;
+    }
+    fflush(stdout);
+
+    /* Each result is "<line number> OK" or "<line number> ERR <reason>" */
+    const char *line;
+    size_t len;
+    long lineNo = 0;
+    int failures = 0;
+    while (lineReaderNext(&lr, &line, &len)) {
+        if (execute(ctx, line, len, &out, ++lineNo) > 0) {
+            failures++;
+        }
+    }
+
+    outClose(&out);
+    free(lr.buf);
+    if (fd != STDIN_FILENO) close(fd);
+    return failures;
+}
+
+
+static int executeOnManager(void *ctx, const char *line, size_t len,
+                            OutBuffer *out, long tag)
+{
+    return executeCommand((BoatManager *)ctx, line, len, out, tag);
+}
+
+
+int runBatch(BoatManager *manager, const char *filename)
+{
+    return runCommandFile(filename, executeOnManager, manager);
+}
+
+
+/* One line of a remittance file, in file order.  status says what became of
+   it; a payment refused as too large also keeps the balance it exceeded. */
+typedef struct {
+    const char *line;       /* the original text, in the mapped file */
+    size_t      len;
+    char        name[MAX_NAME];
+    uint64_t    sortKey;
+    int64_t     amount;
+    long        lineNo;
+    int         status;     /* REMIT_* */
+    int64_t     owed;       /* for REMIT_TOO_MUCH */
+} RemitEntry;
+
+enum { REMIT_POSTED, REMIT_INVALID, REMIT_NO_BOAT, REMIT_TOO_MUCH };
+
+
+static int compareRemitEntries(const void *a, const void *b)
+{
+    /* Boat name order, as for the fleet; file order among same-name lines */
+    const RemitEntry *e1 = *(const RemitEntry *const *)a;
+    const RemitEntry *e2 = *(const RemitEntry *const *)b;
+    int c = compareKeyedNames(e1->sortKey, e1->name, e2->sortKey, e2->name);
+    if (c != 0) return c;
+    return (e1->lineNo > e2->lineNo) - (e1->lineNo < e2->lineNo);
+}
+
+
+static int parseRemitLine(const char *p, const char *end, RemitEntry *e)
+{
+    /* "<boat name>,<amount>"; the amount must be positive */
+    const char *comma = memchr(p, ',', (size_t)(end - p));
+    if (!comma) return 0;
+    const char *nameEnd = comma;
+    while (nameEnd > p && (nameEnd[-1] == ' ' || nameEnd[-1] == '\t')) nameEnd--;
+    const char *stop;
+    if (!copyNameField(p, nameEnd, e->name) ||
+        !(stop = parseAmountField(comma + 1, end, &e->amount)) ||
+        skipBlanks(stop, end) != end || e->amount <= 0) {
+        return 0;
+    }
+    e->sortKey = makeSortKey(e->name);
+    return 1;
+}
+
+
+static void outRejectLine(OutBuffer *out, const RemitEntry *e)
+{
+    /* The original line plus a reason, so a fixed-up copy can be re-posted */
+    size_t len = e->len;
+    while (len > 0 && (e->line[len - 1] == '\r' || e->line[len - 1] == '\n')) len--;
+    for (size_t off = 0; off < len; off += OUT_MAX_ROW) {
+        outReserve(out);
+        outStr(out, e->line + off, len - off < OUT_MAX_ROW ? len - off : OUT_MAX_ROW);
+    }
+    outReserve(out);
+    switch (e->status) {
+        case REMIT_INVALID:
+            outStr(out, ",invalid line", 13);
+            break;
+        case REMIT_NO_BOAT:
+            outStr(out, ",no boat with that name", 23);
+            break;
+        case REMIT_TOO_MUCH:
+            outStr(out, ",more than the amount owed ", 27);
+            outAmount(out, e->owed);
+            break;
+    }
+    outChar(out, '\n');
+}
+
+
+int postRemittance(BoatManager *manager, const char *filename,
+                   const char *rejectsFile, RemittanceResult *result)
+{
+    result->posted   = 0;
+    result->rejected = 0;
+    result->amount   = 0;
+    loadRemainingBoats(manager);  /* the merge-join walks every boat */
+
+    MappedFile mf;
+    if (openMappedFile(&mf, filename) != 0) {
+        fprintf(stderr, "Unable to read remittance file '%s'\n", filename);
+        return -1;
+    }
+
+    /* Parse every line, then order the valid ones by name */
+    size_t cap = 0, count = 0, valid = 0;
+    int outOfMemory = 0;
+    RemitEntry *entries = NULL;
+    const char *p = mf.data, *end = mf.data + mf.size;
+    for (long lineNo = 1; p < end; lineNo++) {
+        const char *eol = memchr(p, '\n', (size_t)(end - p));
+        if (!eol) eol = end;
+        const char *text = skipBlanks(p, eol);
+        if (text < eol && *text != '#') {
+            if (count == cap) {
+                size_t newCap = cap ? cap * 2 : 1024;
+                RemitEntry *grown = (RemitEntry *)realloc(entries, newCap * sizeof(RemitEntry));
+                if (!grown) {
+                    outOfMemory = 1;
+                    break;
+                }
+                entries = grown;
+                cap = newCap;
+            }
+            RemitEntry *e = &entries[count++];
+            e->line   = p;
+            e->len    = (size_t)(eol - p);
+            e->lineNo = lineNo;
+            e->status = parseRemitLine(p, eol, e) ? REMIT_POSTED : REMIT_INVALID;
+            valid += e->status == REMIT_POSTED;
+        }
+        p = eol + 1;
+    }
+    RemitEntry **order = (RemitEntry **)malloc((valid ? valid : 1) * sizeof(RemitEntry *));
+    if (!order || outOfMemory) {
+        fprintf(stderr, "Out of memory reading '%s'\n", filename);
+        free(order);
+        free(entries);
+        closeMappedFile(&mf);
+        return -1;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (entries[i].status == REMIT_POSTED) order[n++] = &entries[i];
+    }
+    qsort(order, n, sizeof(RemitEntry *), compareRemitEntries);
+
+    /* Merge-join against the sorted fleet: both walk forward once */
+    int j = 0;
+    for (size_t i = 0; i < n; i++) {
+        RemitEntry *e = order[i];
+        int c = -1;
+        while (j < manager->numBoats) {
+            const Boat *m = manager->boats[j];
+            c = compareKeyedNames(m->sortKey, m->name, e->sortKey, e->name);
+            if (c >= 0) break;
+            j++;
+        }
+        if (c != 0) {
+            e->status = REMIT_NO_BOAT;
+            continue;
+        }
+        /* With several boats of one name, pay the one acceptPayment would */
+        Boat *b = manager->boats[j];
+        if (j + 1 < manager->numBoats &&
+            compareKeyedNames(manager->boats[j + 1]->sortKey, manager->boats[j + 1]->name,
+                              e->sortKey, e->name) == 0) {
+            b = findBoat(manager, e->name);
+        }
+        if (postPayment(manager, b, e->amount) != 0) {
+            e->status = REMIT_TOO_MUCH;
+            e->owed   = *boatOwed(manager, b);
+            continue;
+        }
+        result->posted++;
+        result->amount += e->amount;
+    }
+
+    /* Rejects in file order */
+    int status = 0;
+    int fd = open(rejectsFile, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    OutBuffer out;
+    if (fd < 0 || outOpen(&out, fd) != 0) {
+        status = -1;
+    } else {
+        for (size_t i = 0; i < count; i++) {
+            if (entries[i].status == REMIT_POSTED) continue;
+            result->rejected++;
+            outRejectLine(&out, &entries[i]);
+        }
+        if (outClose(&out) != 0) status = -1;
+    }
+    if (fd >= 0) close(fd);
+    if (status != 0) {
+        fprintf(stderr, "Unable to write rejects file '%s'\n", rejectsFile);
+        result->rejected = (long)(count - (size_t)result->posted);
+    }
+
+    free(order);
+    free(entries);
+    closeMappedFile(&mf);
+    return status;
+}
+
+
+void importRemittance(BoatManager *manager)
+{
+    char filename[MAX_PATH_LEN];
+    printf("Please enter the remittance file name                    : ");
+    if (!fgets(filename, sizeof(filename), stdin)) {
+        return;
+    }
+    filename[strcspn(filename, "\r\n")] = '\0';
+
+    char rejects[MAX_PATH_LEN + 16];
+    snprintf(rejects, sizeof(rejects), "%s.rejects", filename);
+    RemittanceResult result;
+    if (postRemittance(manager, filename, rejects, &result) != 0 && result.posted == 0) {
+        return;
+    }
+
+    char total[32];
+    printf("Posted %ld payments totalling $%s", result.posted,
+           formatCents(result.amount, total, sizeof(total)));
+    if (result.rejected > 0) {
+        printf("; %ld rejected (see %s)", result.rejected, rejects);
+    }
+    printf("\n");
+}
+
+
+static uint64_t nextRandom(uint64_t *state)
+{
+    /* xorshift64*: cheap, and the same sequence for a seed everywhere */
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+
+static int64_t randomBalance(uint64_t *state)
+{
+    /* Most boats are paid up or owe a little; a few owe a great deal */
+    uint64_t r = nextRandom(state);
+    unsigned int tier = (unsigned int)(r % 100);
+    r >>= 8;
+    if (tier < 45) return 0;
+    if (tier < 85) return (int64_t)(r % 10000);                 /* under $100 */
+    if (tier < 97) return 10000 + (int64_t)(r % 190000);        /* to $2,000 */
+    return 200000 + (int64_t)(r % 4800000);                     /* to $50,000 */
+}
+
+
+int generateFleet(const char *filename, long count, uint64_t seed)
+{
+    static const char *const firstWords[16] = {
+        "Sea", "Salty", "Blue", "Wind", "Star", "Wave", "Lucky", "Silver",
+        "Morning", "Island", "Golden", "Misty", "Northern", "Restless",
+        "Happy", "Ocean"
+    };
+    static const char *const secondWords[16] = {
+        "Breeze", "Dog", "Lady", "Runner", "Spirit", "Dancer", "Dream",
+        "Hunter", "Song", "Wind", "Star", "Chaser", "Rose", "Escape",
+        "Gull", "Tide"
+    };
+
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        fprintf(stderr, "Unable to write file '%s'\n", filename);
+        return -1;
+    }
+    OutBuffer out;
+    if (outOpen(&out, fd) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    uint64_t state = seed ? seed : 1;
+    long slips = 0, spaces = 0;
+    for (long i = 0; i < count; i++) {
+        uint64_t r = nextRandom(&state);
+        const char *first  = firstWords[r & 15];
+        const char *second = secondWords[(r >> 4) & 15];
+
+        /* "<word> <word> <hull number>", hull numbers drawn from 4x the
+           fleet so a few names repeat, as they do in real registries */
+        outReserve(&out);
+        outStr(&out, first, strlen(first));
+        outChar(&out, ' ');
+        outStr(&out, second, strlen(second));
+        outChar(&out, ' ');
+        outInt(&out, 1 + (long long)((r >> 8) % (uint64_t)(4 * count)));
+        outChar(&out, ',');
+
+        /* 10..100 ft, bunched around the middle */
+        outInt(&out, 10 + (r >> 32) % 31 + (r >> 40) % 31 + (r >> 48) % 31);
+        outChar(&out, ',');
+
+        /* Of every 20 boats: 8 in slips, 4 on land, 5 on trailers and 3 in
+           storage; slip and storage numbers are never shared */
+        unsigned int kind = (unsigned int)((r >> 56) % 20);
+        uint64_t d = nextRandom(&state);
+        if (kind < 8) {
+            outStr(&out, "slip,", 5);
+            outInt(&out, ++slips);
+        } else if (kind < 12) {
+            outStr(&out, "land,", 5);
+            outChar(&out, (char)('A' + d % 26));
+        } else if (kind < 17) {
+            outStr(&out, "trailor,", 8);
+            outChar(&out, (char)('0' + d % 10));
+            outChar(&out, (char)('A' + (d >> 8) % 26));
+            outChar(&out, (char)('A' + (d >> 16) % 26));
+            outChar(&out, (char)('0' + (d >> 24) % 10));
+            outChar(&out, (char)('0' + (d >> 32) % 10));
+            outChar(&out, (char)('0' + (d >> 40) % 10));
+        } else {
+            outStr(&out, "storage,", 8);
+            outInt(&out, ++spaces);
+        }
+        outChar(&out, ',');
+        outAmount(&out, randomBalance(&state));
+        outChar(&out, '\n');
+    }
+
+    int status = outClose(&out);
+    if (close(fd) != 0) status = -1;
+    if (status != 0) {
+        fprintf(stderr, "Unable to write file '%s'\n", filename);
+        return -1;
+    }
+    return 0;
+}
+
+
+static double benchClock(void)
+{
+    return (double)monotonicNanos() * 1e-9;
+}
+
+
+static void benchReport(const char *op, long rows, long ops, double seconds,
+                        double bytes)
+{
+    printf("%s,%ld,%ld,%.6f,%.1f,%.1f\n", op, rows, ops, seconds,
+           ops > 0 ? seconds * 1e9 / (double)ops : 0.0,
+           seconds > 0 ? bytes / seconds / 1e6 : 0.0);
+}
+
+
+static double fileBytes(int fd)
+{
+    struct stat st;
+    return fstat(fd, &st) == 0 ? (double)st.st_size : 0.0;
+}
+
+
+static int benchTempFile(char *path, size_t size, const char *tag)
+{
+    const char *dir = getenv("TMPDIR");
+    if (!dir || !*dir) dir = "/tmp";
+    if (snprintf(path, size, "%s/mbs-bench-%s-XXXXXX", dir, tag) >= (int)size) {
+        return -1;
+    }
+    return mkstemp(path);
+}
+
+
+static void benchSize(long rows, int threads, const char *fleetFile,
+                      const char *saveFile, int invFd)
+{
+    BoatManager manager;
+    initBoatManager(&manager);
+    int fd = open(fleetFile, O_RDONLY);
+    double csvBytes = fd >= 0 ? fileBytes(fd) : 0.0;
+    if (fd >= 0) close(fd);
+
+    /* Small fleets repeat each operation so the timings are not just noise */
+    long reps = rows >= BENCH_MIN_OPS ? 1 : BENCH_MIN_OPS / rows;
+    double seconds = 0;
+    for (long r = 0; r < reps; r++) {
+        freeAllBoats(&manager);
+        double t0 = benchClock();
+        loadFromCSV(&manager, fleetFile);
+        seconds += benchClock() - t0;
+    }
+    benchReport("loadFromCSV", rows, rows * reps, seconds, csvBytes * reps);
+    manager.billThreads = threads;
+
+    /* Sorting an already sorted array would flatter qsort: shuffle first */
+    uint64_t state = 12345;
+    long n = manager.numBoats;
+    seconds = 0;
+    for (long r = 0; r < reps; r++) {
+        for (long i = n - 1; i > 0; i--) {
+            long j = (long)(nextRandom(&state) % (uint64_t)(i + 1));
+            Boat *tmp = manager.boats[i];
+            manager.boats[i] = manager.boats[j];
+            manager.boats[j] = tmp;
+        }
+        double t0 = benchClock();
+        sortBoatsByName(&manager);
+        seconds += benchClock() - t0;
+    }
+    benchReport("sortBoatsByName", rows, n * reps, seconds, 0);
+
+    /* Exact-name lookups of boats picked at random */
+    long lookups = n > 0 ? BENCH_MIN_OPS : 0, found = 0;
+    double t0 = benchClock();
+    for (long i = 0; i < lookups; i++) {
+        const Boat *b = manager.boats[nextRandom(&state) % (uint64_t)n];
+        found += findBoatIndex(&manager, b->name) >= 0;
+    }
+    seconds = benchClock() - t0;
+    if (found != lookups) fprintf(stderr, "findBoatIndex missed %ld boats\n", lookups - found);
+    benchReport("findBoatIndex", rows, lookups, seconds, 0);
+
+    /* MB/s here counts the hot columns the billing pass walks */
+    double hotBytes = (double)n * (sizeof(*manager.arena.length) +
+                                   sizeof(*manager.arena.locType) +
+                                   sizeof(*manager.arena.amountOwed));
+    t0 = benchClock();
+    for (long r = 0; r < reps; r++) monthlyUpdate(&manager);
+    seconds = benchClock() - t0;
+    benchReport("monthlyUpdate", rows, n * reps, seconds, hotBytes * reps);
+
+    /* printInventory's formatter, into a scratch file instead of the terminal */
+    double bytes = 0;
+    seconds = 0;
+    for (long r = 0; r < reps; r++) {
+        OutBuffer out;
+        if (lseek(invFd, 0, SEEK_SET) != 0 || ftruncate(invFd, 0) != 0 ||
+            outOpen(&out, invFd) != 0) {
+            break;
+        }
+        t0 = benchClock();
+        writeInventory(&manager, &out, NULL);
+        outClose(&out);
+        seconds += benchClock() - t0;
+        bytes += fileBytes(invFd);
+    }
+    benchReport("writeInventory", rows, n * reps, seconds, bytes);
+
+    bytes = 0;
+    seconds = 0;
+    for (long r = 0; r < reps; r++) {
+        t0 = benchClock();
+        saveToCSV(&manager, saveFile);
+        seconds += benchClock() - t0;
+        fd = open(saveFile, O_RDONLY);
+        if (fd >= 0) {
+            bytes += fileBytes(fd);
+            close(fd);
+        }
+    }
+    benchReport("saveToCSV", rows, n * reps, seconds, bytes);
+
+    freeAllBoats(&manager);
+}
+
+
+int runBenchmark(const long *sizes, int numSizes, int threads)
+{
+    char fleetFile[MAX_PATH_LEN], saveFile[MAX_PATH_LEN], invFile[MAX_PATH_LEN];
+    int fleetFd = benchTempFile(fleetFile, sizeof(fleetFile), "fleet");
+    int saveFd  = fleetFd >= 0 ? benchTempFile(saveFile, sizeof(saveFile), "save") : -1;
+    int invFd   = saveFd >= 0 ? benchTempFile(invFile, sizeof(invFile), "inventory") : -1;
+    int status  = 0;
+    if (invFd < 0) {
+        fprintf(stderr, "Unable to create benchmark scratch files\n");
+        status = -1;
+    }
+
+    if (status == 0) printf("op,rows,ops,seconds,ns_per_op,mb_per_s\n");
+    for (int s = 0; status == 0 && s < numSizes; s++) {
+        double t0 = benchClock();
+        if (generateFleet(fleetFile, sizes[s], (uint64_t)sizes[s]) != 0) {
+            status = -1;
+            break;
+        }
+        double seconds = benchClock() - t0;
+        double bytes = fileBytes(fleetFd);
+        benchReport("generateFleet", sizes[s], sizes[s], seconds, bytes);
+        benchSize(sizes[s], threads, fleetFile, saveFile, invFd);
+        fflush(stdout);
+    }
+
+    if (fleetFd >= 0) { close(fleetFd); unlink(fleetFile); }
+    if (saveFd >= 0)  { close(saveFd);  unlink(saveFile); }
+    if (invFd >= 0)   { close(invFd);   unlink(invFile); }
+    return status;
+}
+
+
+void freeAllBoats(BoatManager *manager)
+{
+    /* Records live in the arena slabs, so there is nothing to free per boat */
+    for (int i = 0; i < manager->arena.numSlabs; i++) {
+        free(manager->arena.slabs[i]);
+    }
+    free(manager->arena.slabs);
+    free(manager->arena.length);
+    free(manager->arena.locType);
+    free(manager->arena.amountOwed);
+    free(manager->arena.locNext);
+    freeStringPool(&manager->arena.strings);
+    free(manager->boats);
+    free(manager->nameIndex.slots);
+    free(manager->locations.slip);
+    free(manager->locations.storage);
+    free(manager->locations.tags.slots);
+    if (manager->lazy) freeLazyFile(manager->lazy);
+    initBoatManager(manager);
+}
+
+
+static void saveAndClose(BoatManager *manager, const char *filename,
+                         DataFormat format, SavePolicy *policy)
+{
+    /* Journal mode only rewrites the snapshot once the journal has grown
+       large; otherwise the full save makes any replayed journal obsolete. */
+    Journal *journal = manager->journal;
+    if (journal) {
+        if (journal->size >= JOURNAL_COMPACT_SIZE) {
+            compactJournal(manager, filename, format, journal);
+        }
+        journalClose(journal);
+        manager->journal = NULL;
+        return;
+    }
+    if (saveChanges(manager, filename, format, policy) == 0) {
+        char path[MAX_PATH_LEN];
+        if (snprintf(path, sizeof(path), "%s.journal", filename) < (int)sizeof(path)) {
+            unlink(path);
+        }
+    }
+}
+
+
+static void autosaveIfDue(BoatManager *manager, const char *filename,
+                          DataFormat format, SavePolicy *policy)
+{
+    /* Periodic autosave, so a crash loses at most one interval of work.
+       With a journal every change is already logged, so the interval is
+       only used to fold an oversized journal into a new snapshot. */
+    if (policy->autosaveInterval <= 0 ||
+        time(NULL) - policy->lastSave < policy->autosaveInterval) {
+        return;
+    }
+    if (!manager->journal) {
+        saveChanges(manager, filename, format, policy);
+    } else if (manager->journal->size >= JOURNAL_COMPACT_SIZE) {
+        compactJournal(manager, filename, format, manager->journal);
+    } else {
+        policy->lastSave = time(NULL);
+    }
+}
+
+
+/* One connection of runServer: request bytes not yet handled, and the
+   replies not yet accepted by the socket (reply is an in-memory OutBuffer).
+   While a listing runs on a reader thread the connection is 'working': its
+   later requests wait, so replies still come back in order.  They wait the
+   same way while the connection is 'waiting' on an add, remove or bill that
+   could not have the fleet lock yet, or on a listing held back meanwhile. */
+enum { WAIT_NONE, WAIT_WRITER, WAIT_READERS };
+
+typedef struct {
+    int       fd;
+    char      in[MAX_LINE];
+    size_t    inLen;
+    int       discarding;  /* inside an overlong line: skip to its end */
+    int       closing;     /* nothing more to read: close once all is sent */
+    int       quit;        /* asked to go with Q: ignore what follows */
+    OutBuffer reply;
+    size_t    sent;        /* bytes of reply already written */
+
+    BoatManager *manager;  /* for the reader thread */
+    int       wakeFd;      /* written by the reader thread when it is done */
+    int       working;     /* a reader thread owns job (main thread only) */
+    int       jobDone;     /* set by the reader thread, atomically */
+    int       waiting;     /* WAIT_*: the request at in is held back */
+    int      *writers;     /* connections at WAIT_WRITER (main thread only) */
+    pthread_t worker;
+    char      jobLine[MAX_LINE];
+    size_t    jobLen;
+    OutBuffer job;
+} ServerClient;
+
+
+static int setNonBlocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+
+static int serverListen(const char *address)
+{
+    /* A path (anything with a '/') is a Unix socket, else [host:]port */
+    int fd = -1;
+    if (strchr(address, '/')) {
+        struct sockaddr_un sun;
+        if (strlen(address) >= sizeof(sun.sun_path)) {
+            fprintf(stderr, "Socket path '%s' is too long\n", address);
+            return -1;
+        }
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        strcpy(sun.sun_path, address);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        unlink(address);  /* a socket left behind by an earlier server */
+        if (fd >= 0 && bind(fd, (struct sockaddr *)&sun, sizeof(sun)) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    } else {
+        /* Loopback unless a host is given, e.g. 0.0.0.0:7070 */
+        char host[256] = "127.0.0.1";
+        const char *port = address, *colon = strrchr(address, ':');
+        if (colon) {
+            size_t n = (size_t)(colon - address);
+            if (n >= sizeof(host)) n = sizeof(host) - 1;
+            memcpy(host, address, n);
+            host[n] = '\0';
+            port = colon + 1;
+        }
+        struct addrinfo hints, *res = NULL;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family   = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags    = AI_PASSIVE;
+        if (getaddrinfo(host, port, &hints, &res) == 0) {
+            for (struct addrinfo *ai = res; ai && fd < 0; ai = ai->ai_next) {
+                fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+                if (fd < 0) continue;
+                int on = 1;
+                setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+                if (bind(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+                    close(fd);
+                    fd = -1;
+                }
+            }
+            freeaddrinfo(res);
+        }
+    }
+    if (fd < 0 || listen(fd, SOMAXCONN) != 0 || setNonBlocking(fd) != 0) {
+        fprintf(stderr, "Unable to listen on '%s'\n", address);
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+static void *listingThread(void *arg)
+{
+    /* executeCommand holds the fleet lock shared for the whole listing, so
+       payments carry on meanwhile and only adds, removes and billing wait */
+    ServerClient *c = (ServerClient *)arg;
+    executeCommand(c->manager, c->jobLine, c->jobLen, &c->job, 0);
+    __atomic_store_n(&c->jobDone, 1, __ATOMIC_RELEASE);
+    char wake = 0;
+    if (write(c->wakeFd, &wake, 1) < 0) {
+        /* the pipe is full, so the server is being woken anyway */
+    }
+    return NULL;
+}
+
+
+static int serverLine(BoatManager *manager, ServerClient *c, char *line,
+                      size_t len)
+{
+    /* Returns 1 if the request is held back (see waiting), else 0 */
+    if (len > 0 && line[len - 1] == '\r') len--;
+
+    /* Q ends this connection; everything else is an executeCommand line */
+    const char *end = line + len;
+    const char *p = skipBlanks(line, end);
+    if (p < end && tolower((unsigned char)*p) == 'q' && skipBlanks(p + 1, end) == end) {
+        outResult(&c->reply, 0, "OK bye");
+        c->closing = c->quit = 1;
+        return 0;
+    }
+
+    /* Waiting for the write lock here would stall every connection until
+       the running listings end, so only try it, and retry once they have */
+    if (exclusiveCommand(line, len)) {
+        if (pthread_rwlock_trywrlock(&manager->locks->lock) != 0) {
+            c->waiting = WAIT_WRITER;
+            (*c->writers)++;
+            return 1;
+        }
+        if (runCommand(manager, line, len, &c->reply, 0) < 0) {
+            outResult(&c->reply, 0, "OK");
+        }
+        pthread_rwlock_unlock(&manager->locks->lock);
+        return 0;
+    }
+
+    /* A listing or report can take a while: hand it to a reader thread,
+       unless a writer is waiting for the ones running to drain */
+    int listing = p < end && (tolower((unsigned char)*p) == 'i' || tolower((unsigned char)*p) == 'o');
+    if (listing && *c->writers > 0) {
+        c->waiting = WAIT_READERS;
+        return 1;
+    }
+    if (listing && outOpen(&c->job, -1) == 0) {
+        memcpy(c->jobLine, line, len);
+        c->jobLen  = len;
+        c->jobDone = 0;
+        if (pthread_create(&c->worker, NULL, listingThread, c) == 0) {
+            c->working = 1;
+            return 0;
+        }
+        outClose(&c->job);
+    }
+    if (executeCommand(manager, line, len, &c->reply, 0) < 0) {
+        /* Blank lines and comments get an answer too, so replies pair up */
+        outResult(&c->reply, 0, "OK");
+    }
+    return 0;
+}
+
+
+static void serverProcess(BoatManager *manager, ServerClient *c)
+{
+    /* Handle the complete lines received, up to a listing handed off; a
+       client that has stopped sending still gets answers to what it sent */
+    size_t start = 0;
+    while (!c->working && !c->waiting && !c->quit) {
+        char *nl = memchr(c->in + start, '\n', c->inLen - start);
+        if (!nl) break;
+        size_t len = (size_t)(nl - (c->in + start));
+        if (!c->discarding && serverLine(manager, c, c->in + start, len) != 0) break;
+        c->discarding = 0;
+        start += len + 1;
+    }
+    memmove(c->in, c->in + start, c->inLen - start);
+    c->inLen -= start;
+
+    if (!c->working && !c->waiting && !c->quit && c->inLen == sizeof(c->in)) {
+        outResult(&c->reply, 0, "ERR line too long");
+        c->discarding = 1;
+        c->inLen = 0;
+    }
+}
+
+
+static int serverRead(BoatManager *manager, ServerClient *c)
+{
+    /* Returns -1 once the peer has hung up or the socket failed */
+    if (c->inLen == sizeof(c->in)) return 0;  /* waiting on a listing */
+    ssize_t n = read(c->fd, c->in + c->inLen, sizeof(c->in) - c->inLen);
+    if (n == 0) return -1;
+    if (n < 0) return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    c->inLen += (size_t)n;
+    serverProcess(manager, c);
+    return 0;
+}
+
+
+static void serverFinishJob(BoatManager *manager, ServerClient *c)
+{
+    /* Queue the listing behind any reply still unsent, then carry on with
+       the requests that arrived meanwhile */
+    pthread_join(c->worker, NULL);
+    c->working = 0;
+    if (c->sent == c->reply.len) {
+        OutBuffer done = c->reply;
+        c->reply = c->job;
+        c->job   = done;
+        c->sent  = 0;
+    } else {
+        for (size_t off = 0; off < c->job.len; off += OUT_MAX_ROW) {
+            size_t n = c->job.len - off < OUT_MAX_ROW ? c->job.len - off : OUT_MAX_ROW;
+            outReserve(&c->reply);
+            outStr(&c->reply, c->job.buf + off, n);
+        }
+    }
+    outClose(&c->job);
+    serverProcess(manager, c);
+}
+
+
+static int serverWrite(ServerClient *c)
+{
+    ssize_t n = write(c->fd, c->reply.buf + c->sent, c->reply.len - c->sent);
+    if (n < 0) return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    c->sent += (size_t)n;
+    if (c->sent == c->reply.len) {
+        /* All sent: start over, giving back what a large listing grew */
+        c->reply.len = c->sent = 0;
+        if (c->reply.cap > OUT_BUF_SIZE) {
+            char *shrunk = (char *)realloc(c->reply.buf, OUT_BUF_SIZE);
+            if (shrunk) {
+                c->reply.buf = shrunk;
+                c->reply.cap = OUT_BUF_SIZE;
+            }
+        }
+    }
+    return 0;
+}
+
+
+static void serverRetry(BoatManager *manager, ServerClient *c)
+{
+    /* Try the held-back request again, and what follows it */
+    if (c->waiting == WAIT_WRITER) (*c->writers)--;
+    c->waiting = WAIT_NONE;
+    serverProcess(manager, c);
+}
+
+
+static void serverDrop(ServerClient *c)
+{
+    if (c->waiting == WAIT_WRITER) (*c->writers)--;
+    if (c->working) {
+        pthread_join(c->worker, NULL);
+        outClose(&c->job);
+    }
+    close(c->fd);
+    outClose(&c->reply);
+    free(c);
+}
+
+
+int runServer(BoatManager *manager, const char *address, const char *dataFile,
+              DataFormat format, SavePolicy *policy)
+{
+    int listenFd = serverListen(address);
+    if (listenFd < 0) return -1;
+
+    /* Listings run on reader threads from here on: the manager needs its
+       locks, and a pipe lets a finished listing wake poll().  A lazy
+       manager loads boats when read, so finish loading it first. */
+    loadRemainingBoats(manager);
+    ManagerLocks locks;
+    int wake[2];
+    if (initManagerLocks(&locks) != 0) {
+        close(listenFd);
+        return -1;
+    }
+    if (pipe(wake) != 0 || setNonBlocking(wake[0]) != 0 || setNonBlocking(wake[1]) != 0) {
+        fprintf(stderr, "Unable to create the server wake-up pipe\n");
+        destroyManagerLocks(&locks);
+        close(listenFd);
+        return -1;
+    }
+    manager->locks = &locks;
+
+    /* Stop signals are held pending and looked for after every poll(), so
+       a shutdown finishes the current request and saves like the X command */
+    sigset_t stopSignals, oldMask, pending;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    sigaddset(&stopSignals, SIGHUP);
+    sigprocmask(SIG_BLOCK, &stopSignals, &oldMask);
+    signal(SIGPIPE, SIG_IGN);  /* a vanished client is a write error, not death */
+    fprintf(stderr, "Serving %d boats on %s\n", manager->numBoats, address);
+
+    ServerClient *clients[MAX_CLIENTS];
+    struct pollfd fds[MAX_CLIENTS + 2];
+    int numClients = 0, running = 1, writers = 0;
+    while (running) {
+        fds[0].fd      = listenFd;
+        fds[0].events  = numClients < MAX_CLIENTS ? POLLIN : 0;
+        fds[0].revents = 0;
+        fds[1].fd      = wake[0];
+        fds[1].events  = POLLIN;
+        fds[1].revents = 0;
+        for (int i = 0; i < numClients; i++) {
+            ServerClient *c = clients[i];
+            size_t unsent = c->reply.len - c->sent;
+            fds[i + 2].fd      = c->fd;
+            fds[i + 2].events  = 0;
+            fds[i + 2].revents = 0;
+            /* Stop reading from a client that is not taking its replies */
+            if (!c->closing && !c->working && !c->waiting && unsent < OUT_BUF_SIZE) {
+                fds[i + 2].events |= POLLIN;
+            }
+            if (unsent > 0) fds[i + 2].events |= POLLOUT;
+            if (fds[i + 2].events == 0) fds[i + 2].fd = -1;  /* not even POLLHUP */
+        }
+
+        int polled = numClients;
+        int ready = poll(fds, (nfds_t)(polled + 2), SERVER_TICK_MS);
+        if (ready < 0 && errno != EINTR) {
+            fprintf(stderr, "poll failed\n");
+            break;
+        }
+        if (sigpending(&pending) == 0 &&
+            (sigismember(&pending, SIGINT) == 1 || sigismember(&pending, SIGTERM) == 1 ||
+             sigismember(&pending, SIGHUP) == 1)) {
+            running = 0;
+        }
+
+        /* Listings that have finished go out ahead of anything new */
+        if (ready > 0 && (fds[1].revents & POLLIN)) {
+            char drain[64];
+            while (read(wake[0], drain, sizeof(drain)) > 0) {
+            }
+            for (int i = 0; i < polled; i++) {
+                ServerClient *c = clients[i];
+                if (c->working && __atomic_load_n(&c->jobDone, __ATOMIC_ACQUIRE)) {
+                    serverFinishJob(manager, c);
+                }
+            }
+        }
+
+        /* Held-back writers first, then the listings held behind them */
+        for (int i = 0; i < polled; i++) {
+            if (clients[i]->waiting == WAIT_WRITER) serverRetry(manager, clients[i]);
+        }
+        for (int i = 0; i < polled; i++) {
+            if (clients[i]->waiting == WAIT_READERS) serverRetry(manager, clients[i]);
+        }
+
+        /* Requests from every readable client, then whatever can be sent */
+        for (int i = 0; i < polled; i++) {
+            ServerClient *c = clients[i];
+            short ev = fds[i + 2].revents;
+            int dead = 0;
+            if (ev & (POLLIN | POLLHUP | POLLERR)) {
+                if (serverRead(manager, c) != 0) {
+                    c->closing = 1;
+                    dead = (ev & POLLERR) != 0;
+                }
+            }
+            if (!dead && c->reply.len > c->sent && serverWrite(c) != 0) dead = 1;
+            if (dead || (c->closing && !c->working && !c->waiting && c->reply.len == c->sent)) {
+                serverDrop(c);
+                clients[i] = NULL;
+            }
+        }
+        int kept = 0;
+        for (int i = 0; i < numClients; i++) {
+            if (clients[i]) clients[kept++] = clients[i];
+        }
+        numClients = kept;
+
+        if (ready > 0 && (fds[0].revents & POLLIN)) {
+            int fd;
+            while (numClients < MAX_CLIENTS && (fd = accept(listenFd, NULL, NULL)) >= 0) {
+                ServerClient *c = (ServerClient *)malloc(sizeof(ServerClient));
+                if (!c || setNonBlocking(fd) != 0 || outOpen(&c->reply, -1) != 0) {
+                    free(c);
+                    close(fd);
+                    continue;
+                }
+                c->fd = fd;
+                c->inLen = 0;
+                c->discarding = c->closing = c->quit = 0;
+                c->sent = 0;
+                c->manager = manager;
+                c->wakeFd  = wake[1];
+                c->working = 0;
+                c->waiting = WAIT_NONE;
+                c->writers = &writers;
+                clients[numClients++] = c;
+            }
+        }
+
+        lockFleet(manager, 0);
+        autosaveIfDue(manager, dataFile, format, policy);
+        unlockFleet(manager);
+    }
+
+    /* Dropping a client waits for its listing, so no thread outlives this */
+    for (int i = 0; i < numClients; i++) serverDrop(clients[i]);
+    manager->locks = NULL;
+    destroyManagerLocks(&locks);
+    close(wake[0]);
+    close(wake[1]);
+    close(listenFd);
+    if (strchr(address, '/')) unlink(address);
+    fprintf(stderr, "Server stopped\n");
+
+    /* Take the stop signals off the queue, or unblocking would deliver them */
+    int sig;
+    while (sigpending(&pending) == 0 &&
+           (sigismember(&pending, SIGINT) == 1 || sigismember(&pending, SIGTERM) == 1 ||
+            sigismember(&pending, SIGHUP) == 1)) {
+        sigwait(&stopSignals, &sig);
+    }
+    sigprocmask(SIG_SETMASK, &oldMask, NULL);
+    return 0;
+}
+
+
+void initFleet(Fleet *fleet, int workers)
 {
-    /* qsort comparator must take two 'const void*' pointers, each to a Boat* */
-    Boat * const *b1 = (Boat **)p1;
-    Boat * const *b2 = (Boat **)p2;
-    if (*b1 == NULL && *b2 == NULL) return 0;
-    if (*b1 == NULL) return 1;   /* push NULLs to the end, if any */
-    if (*b2 == NULL) return -1;
-    return caseInsensitiveCompare((*b1)->name, (*b2)->name);
+    fleet->shards    = NULL;
+    fleet->files     = NULL;
+    fleet->formats   = NULL;
+    fleet->numShards = 0;
+    fleet->capacity  = 0;
+    fleet->workers   = workers > 0 ? workers : 1;
 }
 
-void sortBoatsByName(BoatManager *manager)
+
+static int addFleetFile(Fleet *fleet, const char *path, int forceFormat)
 {
-    /* Only sort the active portion (manager->numBoats). */
-    qsort(manager->boats, manager->numBoats, sizeof(Boat*), boatCompareByName);
+    if (fleet->numShards == fleet->capacity) {
+        int newCap = fleet->capacity ? fleet->capacity * 2 : 16;
+        BoatManager *shards = (BoatManager *)realloc(fleet->shards, newCap * sizeof(BoatManager));
+        if (shards) fleet->shards = shards;
+        char **files = (char **)realloc(fleet->files, newCap * sizeof(char*));
+        if (files) fleet->files = files;
+        DataFormat *formats = (DataFormat *)realloc(fleet->formats, newCap * sizeof(DataFormat));
+        if (formats) fleet->formats = formats;
+        if (!shards || !files || !formats) return -1;
+        fleet->capacity = newCap;
+    }
+    size_t n = strlen(path) + 1;
+    char *copy = (char *)malloc(n);
+    if (!copy) return -1;
+    memcpy(copy, path, n);
+
+    int s = fleet->numShards++;
+    initBoatManager(&fleet->shards[s]);
+    fleet->files[s]   = copy;
+    fleet->formats[s] = forceFormat >= 0 ? (DataFormat)forceFormat : dataFormatForFile(path);
+    return 0;
 }
 
 
-Boat* createBoat(const char *name, int length, LocationType locType,
-                 const char *detailStr, double owed)
+static int compareFileNames(const void *a, const void *b)
 {
-    Boat *b = (Boat *)malloc(sizeof(Boat));
-    if (!b) {
-        /* Caller can handle error message or fallback if needed. */
-        return NULL;
-    }
-    /* Initialize the fields carefully */
-    strncpy(b->name, name, MAX_NAME - 1);
-    b->name[MAX_NAME - 1] = '\0';
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
 
-    b->length     = length;
-    b->locType    = locType;
-    b->amountOwed = owed;
 
-    /* Initialize the union depending on location type */
-    switch (locType) {
-        case SLIP:
-            b->detail.slipNumber = atoi(detailStr);
-            break;
-        case LAND:
-            b->detail.bayLetter = detailStr[0];  /* e.g. 'C' */
-            break;
-        case TRAILOR:
-            /* copy the tag up to 31 chars */
-            strncpy(b->detail.licenseTag, detailStr, 31);
-            b->detail.licenseTag[31] = '\0';
-            break;
-        case STORAGE:
-            b->detail.storageNum = atoi(detailStr);
+int addFleetPath(Fleet *fleet, const char *path, int forceFormat)
+{
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        return addFleetFile(fleet, path, forceFormat) == 0 ? 0 : -1;
+    }
+
+    /* A directory: every .csv and .mbs file in it, in name order */
+    DIR *dir = opendir(path);
+    if (!dir) {
+        fprintf(stderr, "Unable to read directory '%s'\n", path);
+        return -1;
+    }
+    char **names = NULL;
+    int numNames = 0, capNames = 0, status = 0;
+    for (struct dirent *entry; status == 0 && (entry = readdir(dir)) != NULL; ) {
+        size_t n = strlen(entry->d_name);
+        if (n < 5 || entry->d_name[0] == '.' ||
+            (caseInsensitiveCompare(entry->d_name + n - 4, ".csv") != 0 &&
+             caseInsensitiveCompare(entry->d_name + n - 4, ".mbs") != 0)) {
+            continue;
+        }
+        if (numNames == capNames) {
+            capNames = capNames ? capNames * 2 : 16;
+            char **grown = (char **)realloc(names, capNames * sizeof(char*));
+            if (!grown) {
+                status = -1;
+                break;
+            }
+            names = grown;
+        }
+        size_t size = strlen(path) + n + 2;
+        char *full = (char *)malloc(size);
+        if (!full) {
+            status = -1;
             break;
+        }
+        snprintf(full, size, "%s/%s", path, entry->d_name);
+        names[numNames++] = full;
     }
-    return b;
+    closedir(dir);
+
+    qsort(names, numNames, sizeof(char*), compareFileNames);
+    for (int i = 0; i < numNames; i++) {
+        if (status == 0) status = addFleetFile(fleet, names[i], forceFormat);
+        free(names[i]);
+    }
+    free(names);
+    if (status == 0 && numNames == 0) {
+        fprintf(stderr, "No .csv or .mbs files in '%s'\n", path);
+        status = -1;
+    }
+    return status;
 }
 
 
-void loadFromCSV(BoatManager *manager, const char *filename)
+/* One of forEachShard's workers; they share the next-shard counter */
+typedef struct {
+    Fleet *fleet;
+    int   *next;
+    void (*work)(Fleet *, int, void *);
+    void  *ctx;
+} ShardWorker;
+
+
+static void* shardWorkerThread(void *arg)
 {
-    FILE *fp = fopen(filename, "r");
-    if (!fp) {
-        /* If file does not exist or can't open, we just return an empty manager */
-        return;
+    ShardWorker *w = (ShardWorker *)arg;
+    int s;
+    while ((s = __atomic_fetch_add(w->next, 1, __ATOMIC_RELAXED)) < w->fleet->numShards) {
+        w->work(w->fleet, s, w->ctx);
     }
+    return NULL;
+}
 
-    char line[512];
-    while (fgets(line, sizeof(line), fp)) {
-        /*
-         * Each line: boatName,length,locType,detail,owed
-         * Example: "Big Brother,20,slip,27,1450.00"
-         *
-         * We must parse carefully (boat name might contain spaces but not commas).
-         * We can safely do something like:
-         *   sscanf(line, " %[^,],%d,%[^,],%[^,],%lf", ...)
-         */
-        char boatName[128], locStr[32], detailStr[64];
-        int length;
-        double owed;
-
-        if (5 == sscanf(line, " %[^,],%d,%[^,],%[^,],%lf",
-                        boatName, &length, locStr, detailStr, &owed)) 
-        {
-            /* Create new boat struct */
-            Boat *b = createBoat(boatName, length, parseLocationType(locStr),
-                                 detailStr, owed);
-            if (b) {
-                /* Insert into manager if there's room. */
-                if (manager->numBoats < MAX_BOATS) {
-                    manager->boats[manager->numBoats] = b;
-                    manager->numBoats++;
-                } else {
-                    /* If we are full, discard the boat (or handle differently). */
-                    free(b);
-                }
-            }
-        }
-        /* else if parse fails, we skip that line. */
-    }
 
-    fclose(fp);
-    /* Finally, ensure sorted after loading. */
-    sortBoatsByName(manager);
+static void forEachShard(Fleet *fleet, void (*work)(Fleet *, int, void *), void *ctx)
+{
+    /* Workers take shards off a shared counter rather than fixed slices,
+       so one big marina does not leave the other workers idle */
+    int workers = fleet->workers < fleet->numShards ? fleet->workers : fleet->numShards;
+    if (workers > MAX_THREADS) workers = MAX_THREADS;
+    if (workers < 1) return;
+
+    ShardWorker tasks[MAX_THREADS];
+    int next = 0;
+    for (int t = 0; t < workers; t++) {
+        tasks[t].fleet = fleet;
+        tasks[t].next  = &next;
+        tasks[t].work  = work;
+        tasks[t].ctx   = ctx;
+    }
+    runParallel(shardWorkerThread, tasks, sizeof(ShardWorker), workers);
 }
 
 
-void saveToCSV(const BoatManager *manager, const char *filename)
+static void loadShard(Fleet *fleet, int s, void *ctx)
 {
-    FILE *fp = fopen(filename, "w");
-    if (!fp) {
-        fprintf(stderr, "Unable to write file '%s'\n", filename);
+    BoatManager *shard = &fleet->shards[s];
+    if (loadFleet(shard, fleet->files[s], fleet->formats[s], 1) != 0) {
+        __atomic_store_n((int *)ctx, 1, __ATOMIC_RELAXED);
         return;
     }
+    replayJournal(shard, fleet->files[s]);
+}
 
-    /* Write each boat in CSV format. */
-    for (int i = 0; i < manager->numBoats; i++) {
-        Boat *b = manager->boats[i];
-        if (!b) continue;  /* safety check */
 
-        switch (b->locType) {
-            case SLIP:
-                fprintf(fp, "%s,%d,slip,%d,%.2f\n",
-                        b->name, b->length, b->detail.slipNumber, b->amountOwed);
-                break;
-            case LAND:
-                fprintf(fp, "%s,%d,land,%c,%.2f\n",
-                        b->name, b->length, b->detail.bayLetter, b->amountOwed);
-                break;
-            case TRAILOR:
-                fprintf(fp, "%s,%d,trailor,%s,%.2f\n",
-                        b->name, b->length, b->detail.licenseTag, b->amountOwed);
-                break;
-            case STORAGE:
-                fprintf(fp, "%s,%d,storage,%d,%.2f\n",
-                        b->name, b->length, b->detail.storageNum, b->amountOwed);
-                break;
-        }
-    }
+int loadFleetShards(Fleet *fleet)
+{
+    int failed = 0;
+    forEachShard(fleet, loadShard, &failed);
+    return failed ? -1 : 0;
+}
+
 
-    fclose(fp);
+static void saveShard(Fleet *fleet, int s, void *ctx)
+{
+    /* A copy each, since saving updates the policy's timestamps */
+    SavePolicy policy = *(const SavePolicy *)ctx;
+    saveAndClose(&fleet->shards[s], fleet->files[s], fleet->formats[s], &policy);
 }
 
 
-void printInventory(const BoatManager *manager)
+void saveFleetShards(Fleet *fleet, const SavePolicy *policy)
 {
-    /*
-     * Example line format from the spec:
-     *   Big Brother           20'    slip   # 27   Owes $1200.00
-     *
-     * We'll use a carefully aligned printf approach.
-     */
-    for (int i = 0; i < manager->numBoats; i++) {
-        const Boat *b = manager->boats[i];
-        if (!b) continue;  /* skip nulls if any exist */
+    forEachShard(fleet, saveShard, (void *)policy);
+}
 
-        /* Print the boat name left-justified in ~22 spaces. */
-        printf("%-22s %2d' ", b->name, b->length);
 
-        switch (b->locType) {
-            case SLIP:
-                printf("   slip   # %2d   Owes $%7.2f\n",
-                       b->detail.slipNumber, b->amountOwed);
-                break;
-            case LAND:
-                printf("   land      %c   Owes $%7.2f\n",
-                       b->detail.bayLetter, b->amountOwed);
-                break;
-            case TRAILOR:
-                printf("trailor %6s   Owes $%7.2f\n",
-                       b->detail.licenseTag, b->amountOwed);
-                break;
-            case STORAGE:
-                printf("storage   # %2d   Owes $%7.2f\n",
-                       b->detail.storageNum, b->amountOwed);
-                break;
-        }
+void freeFleet(Fleet *fleet)
+{
+    for (int s = 0; s < fleet->numShards; s++) {
+        freeAllBoats(&fleet->shards[s]);
+        free(fleet->files[s]);
     }
-    printf("\n");
+    free(fleet->shards);
+    free(fleet->files);
+    free(fleet->formats);
+    initFleet(fleet, fleet->workers);
 }
 
 
-int findBoatIndex(const BoatManager *manager, const char *name)
+/* Where the k-way merge of writeFleetInventory is in one shard */
+typedef struct {
+    int pos, stop;
+} ShardCursor;
+
+
+static inline int shardAhead(const Fleet *fleet, const ShardCursor *cur, int a, int b)
 {
-    /* Linear search for a boat with a matching name (case-insensitive). */
-    for (int i = 0; i < manager->numBoats; i++) {
-        if (caseInsensitiveCompare(manager->boats[i]->name, name) == 0) {
-            return i;
-        }
-    }
-    return -1;
+    /* Whether shard a's next boat comes before shard b's; on equal names
+       the earlier shard goes first, so the merge is stable */
+    const Boat *x = fleet->shards[a].boats[cur[a].pos];
+    const Boat *y = fleet->shards[b].boats[cur[b].pos];
+    int c = compareKeyedNames(x->sortKey, x->name, y->sortKey, y->name);
+    return c < 0 || (c == 0 && a < b);
 }
 
 
-void addBoat(BoatManager *manager)
+static void siftShardDown(const Fleet *fleet, const ShardCursor *cur, int *heap,
+                          int size, int i)
 {
-    /* Prompt for CSV-like line, e.g. "Brooks,34,trailor,AAR666,99.00" */
-    char line[512];
-    printf("Please enter the boat data in CSV format                 : ");
-    if (!fgets(line, sizeof(line), stdin)) {
-        /* EOF or input error */
-        return;
+    for (;;) {
+        int least = i, l = 2 * i + 1, r = l + 1;
+        if (l < size && shardAhead(fleet, cur, heap[l], heap[least])) least = l;
+        if (r < size && shardAhead(fleet, cur, heap[r], heap[least])) least = r;
+        if (least == i) return;
+        int t = heap[i];
+        heap[i] = heap[least];
+        heap[least] = t;
+        i = least;
     }
-    /* Remove trailing newline if any */
-    line[strcspn(line, "\n")] = '\0';
+}
 
-    /* We'll parse: name, length, locStr, detail, owed */
-    char boatName[128], locStr[32], detailStr[64];
-    int length;
-    double owed;
 
-    if (5 != sscanf(line, " %[^,],%d,%[^,],%[^,],%lf",
-                    boatName, &length, locStr, detailStr, &owed)) {
-        printf("Invalid CSV format.\n");
-        return;
+long writeFleetInventory(const Fleet *fleet, OutBuffer *out,
+                         const InventoryFilter *filter)
+{
+    InventoryFilter all;
+    if (!filter) {
+        initInventoryFilter(&all);
+        filter = &all;
     }
 
-    if (manager->numBoats >= MAX_BOATS) {
-        printf("Cannot add new boat: array is full.\n");
-        return;
+    /* A min-heap of shards keyed by each one's next boat: every row costs
+       O(log shards) and the shards' arrays are never joined */
+    ShardCursor *cur = (ShardCursor *)malloc((fleet->numShards + 1) * sizeof(ShardCursor));
+    int *heap = (int *)malloc((fleet->numShards + 1) * sizeof(int));
+    if (!cur || !heap) {
+        free(cur);
+        free(heap);
+        return -1;
     }
-
-    Boat *b = createBoat(boatName, length, parseLocationType(locStr), detailStr, owed);
-    if (!b) {
-        printf("Memory allocation error.\n");
-        return;
+    int size = 0;
+    for (int s = 0; s < fleet->numShards; s++) {
+        const BoatManager *shard = &fleet->shards[s];
+        cur[s].pos  = 0;
+        cur[s].stop = shard->numBoats;
+        if (filter->prefix[0]) {
+            cur[s].stop = findBoatsByPrefix(shard, filter->prefix, &cur[s].pos);
+            cur[s].stop += cur[s].pos;
+        }
+        if (cur[s].pos < cur[s].stop) heap[size++] = s;
     }
+    for (int i = size / 2 - 1; i >= 0; i--) siftShardDown(fleet, cur, heap, size, i);
 
-    /* Add the boat to the end, then re-sort. */
-    manager->boats[manager->numBoats] = b;
-    manager->numBoats++;
-    sortBoatsByName(manager);
+    long skipped = 0, rows = 0;
+    while (size > 0 && (filter->limit < 0 || rows < filter->limit)) {
+        int s = heap[0];
+        const BoatManager *shard = &fleet->shards[s];
+        const Boat *b = shard->boats[cur[s].pos++];
+        if (cur[s].pos == cur[s].stop) heap[0] = heap[--size];
+        siftShardDown(fleet, cur, heap, size, 0);
+
+        if (!inventoryShows(shard, b, filter)) continue;
+        if (skipped < filter->offset) {
+            skipped++;
+            continue;
+        }
+        outBoatLine(shard, b, out);
+        rows++;
+    }
+    free(cur);
+    free(heap);
+    return rows;
 }
 
 
-void removeBoat(BoatManager *manager)
+static int findMarina(const Fleet *fleet, const char *name, size_t n)
 {
-    /* Prompt user for boat name */
-    char name[128];
-    printf("Please enter the boat name                               : ");
-    if (!fgets(name, sizeof(name), stdin)) {
-        return;
+    /* A shard's marina is its file name without directory or extension */
+    for (int s = 0; s < fleet->numShards; s++) {
+        const char *base = strrchr(fleet->files[s], '/');
+        base = base ? base + 1 : fleet->files[s];
+        const char *dot = strrchr(base, '.');
+        size_t len = dot && dot != base ? (size_t)(dot - base) : strlen(base);
+        if (len == n && strncasecmp(base, name, n) == 0) return s;
     }
-    name[strcspn(name, "\n")] = '\0';
+    return -1;
+}
 
-    int idx = findBoatIndex(manager, name);
-    if (idx < 0) {
-        printf("No boat with that name\n");
-        return;
-    }
 
-    /* Free the boat's memory */
-    free(manager->boats[idx]);
-    manager->boats[idx] = NULL;
+/* Month-end over a fleet: the arguments, and what each shard billed */
+typedef struct {
+    const char    *args, *end;
+    BillingTotals *totals;
+    int            failed;
+} FleetBilling;
 
-    /* Shift array elements left to fill the gap */
-    for (int i = idx; i < manager->numBoats - 1; i++) {
-        manager->boats[i] = manager->boats[i + 1];
-    }
-    manager->numBoats--;
 
-    /* Re-sort (technically optional after removal, but let's keep it consistent) */
-    sortBoatsByName(manager);
+static void billShard(Fleet *fleet, int s, void *ctx)
+{
+    FleetBilling *billing = (FleetBilling *)ctx;
+    if (billPeriodArgs(&fleet->shards[s], billing->args, billing->end,
+                       &billing->totals[s]) != 0) {
+        __atomic_store_n(&billing->failed, 1, __ATOMIC_RELAXED);
+    }
 }
 
 
-void acceptPayment(BoatManager *manager)
+int executeFleetCommand(Fleet *fleet, const char *line, size_t len,
+                        OutBuffer *out, long tag)
 {
-    char name[128];
-    printf("Please enter the boat name                               : ");
-    if (!fgets(name, sizeof(name), stdin)) {
-        return;
-    }
-    name[strcspn(name, "\n")] = '\0';
+    const char *end = line + len;
+    const char *p = skipBlanks(line, end);
+    if (p == end || *p == '#') return -1;
 
-    int idx = findBoatIndex(manager, name);
-    if (idx < 0) {
-        printf("No boat with that name\n");
-        return;
+    if (*p == '@') {
+        /* "@<marina>,<command>": any command, on that marina alone */
+        const char *comma = memchr(p, ',', end - p);
+        if (!comma) return outResult(out, tag, "ERR expected @<marina>,<command>");
+        const char *nameEnd = comma;
+        while (nameEnd > p + 1 && (nameEnd[-1] == ' ' || nameEnd[-1] == '\t')) nameEnd--;
+        int s = findMarina(fleet, p + 1, (size_t)(nameEnd - p - 1));
+        if (s < 0) return outResult(out, tag, "ERR no marina with that name");
+        return executeCommand(&fleet->shards[s], comma + 1, (size_t)(end - comma - 1), out, tag);
     }
 
-    double payment;
-    printf("Please enter the amount to be paid                       : ");
-    if (scanf("%lf", &payment) != 1) {
-        /* flush leftover input */
-        while (getchar() != '\n') { }
-        return;
-    }
-    /* flush newline */
-    while (getchar() != '\n') { }
+    char cmd = (char)tolower((unsigned char)*p);
+    const char *args = p + 1;
+    if (args < end && *args == ',') args++;
 
-    /* Check if payment exceeds amount owed */
-    Boat *b = manager->boats[idx];
-    if (payment > b->amountOwed) {
-        printf("That is more than the amount owed, $%.2f\n", b->amountOwed);
-        return;
+    switch (cmd) {
+        case 'p':
+        case 'r': {
+            /* The boat's own marina takes it (the first, if several have
+               the name); failing that the first marina gives the error.
+               Only the name index is probed, so --stats counts the one
+               lookup the command itself makes, not one per marina. */
+            char name[MAX_NAME];
+            const char *comma = memchr(args, ',', end - args);
+            if (copyNameField(args, comma ? comma : end, name)) {
+                for (int s = 0; s < fleet->numShards; s++) {
+                    if (probeName(&fleet->shards[s].nameIndex, name)) {
+                        return executeCommand(&fleet->shards[s], line, len, out, tag);
+                    }
+                }
+            }
+            return executeCommand(&fleet->shards[0], line, len, out, tag);
+        }
+        case 'm': {
+            /* Every shard bills on its own worker */
+            FleetBilling billing = { args, end, NULL, 0 };
+            billing.totals = (BillingTotals *)calloc(fleet->numShards, sizeof(BillingTotals));
+            if (!billing.totals) return outResult(out, tag, "ERR out of memory");
+            forEachShard(fleet, billShard, &billing);
+            BillingTotals sum;
+            memset(&sum, 0, sizeof(sum));
+            for (int s = 0; s < fleet->numShards; s++) {
+                for (int loc = 0; loc < 4; loc++) sum.billed[loc] += billing.totals[s].billed[loc];
+                sum.owingDelta += billing.totals[s].owingDelta;
+            }
+            free(billing.totals);
+            if (billing.failed) {
+                return outResult(out, tag,
+                                 "ERR expected M[,<months>|,<YYYY-MM>,<YYYY-MM>]");
+            }
+            outBilledResult(out, tag, &sum);
+            return 0;
+        }
+        case 's': {
+            FleetTotals sum;
+            long numBoats = 0;
+            memset(&sum, 0, sizeof(sum));
+            for (int s = 0; s < fleet->numShards; s++) {
+                const FleetTotals *t = &fleet->shards[s].totals;
+                numBoats      += fleet->shards[s].numBoats;
+                sum.totalOwed += t->totalOwed;
+                sum.numOwing  += t->numOwing;
+                for (int loc = 0; loc < 4; loc++) {
+                    sum.count[loc]  += t->count[loc];
+                    sum.owed[loc]   += t->owed[loc];
+                    sum.billed[loc] += t->billed[loc];
+                }
+            }
+            outTotalsResult(out, tag, numBoats, &sum);
+            return 0;
+        }
+        case 'i': {
+            InventoryFilter filter;
+            if (parseInventoryFilter(args, end, &filter) != 0) {
+                return outResult(out, tag, "ERR invalid inventory filter");
+            }
+            writeFleetInventory(fleet, out, &filter);
+            outReserve(out);
+            outChar(out, '\n');
+            return outResult(out, tag, "OK");
+        }
+        case 't':
+            /* The shards share one set of statistics */
+            return executeCommand(&fleet->shards[0], line, len, out, tag);
+        default:
+            return outResult(out, tag, "ERR use @<marina>,<command> for that");
     }
-    /* Subtract the payment */
-    b->amountOwed -= payment;
 }
 
 
-void monthlyUpdate(BoatManager *manager)
+static int executeOnFleet(void *ctx, const char *line, size_t len,
+                          OutBuffer *out, long tag)
 {
-    /* Add monthly charges based on boat length and location */
-    for (int i = 0; i < manager->numBoats; i++) {
-        Boat *b = manager->boats[i];
-        if (!b) continue;
+    return executeFleetCommand((Fleet *)ctx, line, len, out, tag);
+}
 
-        double charge = 0.0;
-        switch (b->locType) {
-            case SLIP:
-                charge = MONTH_SLIP * b->length;
-                break;
-            case LAND:
-                charge = MONTH_LAND * b->length;
-                break;
-            case TRAILOR:
-                charge = MONTH_TRAILOR * b->length;
-                break;
-            case STORAGE:
-                charge = MONTH_STORAGE * b->length;
-                break;
-        }
-        b->amountOwed += charge;
-    }
+
+int runFleetBatch(Fleet *fleet, const char *filename)
+{
+    return runCommandFile(filename, executeOnFleet, fleet);
 }
 
 
-void freeAllBoats(BoatManager *manager)
+static int parseListFilter(const char *spec, long limit, long offset,
+                           InventoryFilter *filter)
 {
-    for (int i = 0; i < manager->numBoats; i++) {
-        if (manager->boats[i]) {
-            free(manager->boats[i]);
-            manager->boats[i] = NULL;
-        }
+    /* --inventory's --filter, --limit and --offset as one filter */
+    if (parseInventoryFilter(spec, spec + strlen(spec), filter) != 0) {
+        fprintf(stderr, "Invalid inventory filter '%s'\n", spec);
+        return -1;
     }
-    manager->numBoats = 0;
+    if (limit >= 0) filter->limit = limit;
+    if (offset > 0) filter->offset = offset;
+    return 0;
 }
 
 
@@ -570,21 +6705,260 @@ void freeAllBoats(BoatManager *manager)
 
 int main(int argc, char *argv[])
 {
-    /* Check for command-line argument: CSV file name. */
-    if (argc < 2) {
-        fprintf(stderr, "Usage: %s <BoatData.csv>\n", argv[0]);
+    /* Check for command-line arguments: options, then the CSV file name. */
+    const char *dataFile = NULL;
+    const char *dataPaths[MAX_FLEET_PATHS];
+    int numPaths = 0;
+    int loadThreads = 1, threadsSet = 0;
+    SavePolicy policy = { FSYNC_ALWAYS, 0, 0, 0, 0 };
+    int useJournal = 0;
+    int forceFormat = -1;             /* -1: decide from the file extension */
+    const char *importFile = NULL, *exportFile = NULL;
+    const char *batchFile = NULL;
+    const char *serveAddress = NULL;
+    const char *ratesFile = NULL;
+    int listOnly = 0;
+    const char *filterSpec = "";
+    long listLimit = -1, listOffset = 0;
+    long generateCount = -1;
+    long benchSizes[MAX_BENCH_SIZES];
+    int numBenchSizes = 0;
+    int wantStats = 0;
+    int lazyOpen = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            /* Loader and month-end workers; 0 means one per online CPU */
+            loadThreads = atoi(argv[++i]);
+            if (loadThreads <= 0) loadThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+            threadsSet = 1;
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "csv") == 0) {
+                forceFormat = FORMAT_CSV;
+            } else if (strcmp(argv[i], "binary") == 0) {
+                forceFormat = FORMAT_BINARY;
+            } else {
+                dataFile = NULL;
+                break;
+            }
+        } else if (strcmp(argv[i], "--import") == 0 && i + 1 < argc) {
+            importFile = argv[++i];
+        } else if (strcmp(argv[i], "--export") == 0 && i + 1 < argc) {
+            exportFile = argv[++i];
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batchFile = argv[++i];
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            serveAddress = argv[++i];
+        } else if (strcmp(argv[i], "--rates") == 0 && i + 1 < argc) {
+            ratesFile = argv[++i];
+        } else if (strcmp(argv[i], "--inventory") == 0) {
+            listOnly = 1;
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filterSpec = argv[++i];
+        } else if (strcmp(argv[i], "--limit") == 0 && i + 1 < argc) {
+            listLimit = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--offset") == 0 && i + 1 < argc) {
+            listOffset = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--generate") == 0 && i + 1 < argc) {
+            generateCount = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            /* Fleet sizes, comma-separated; default 1K, 100K and 10M */
+            const char *sizes = (i + 1 < argc && isdigit((unsigned char)argv[i + 1][0]))
+                              ? argv[++i] : "1000,100000,10000000";
+            numBenchSizes = 0;
+            for (char *next; *sizes && numBenchSizes < MAX_BENCH_SIZES; sizes = next) {
+                long n = strtol(sizes, &next, 10);
+                if (next == sizes || n <= 0) break;
+                benchSizes[numBenchSizes++] = n;
+                if (*next == ',') next++;
+            }
+            if (numBenchSizes == 0) break;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            wantStats = 1;
+        } else if (strcmp(argv[i], "--lazy") == 0) {
+            lazyOpen = 1;
+        } else if (strcmp(argv[i], "--journal") == 0) {
+            useJournal = 1;
+        } else if (strcmp(argv[i], "--autosave") == 0 && i + 1 < argc) {
+            policy.autosaveInterval = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--fsync") == 0 && i + 1 < argc) {
+            /* always | never | N (at most one fsync every N seconds) */
+            const char *mode = argv[++i];
+            if (strcmp(mode, "always") == 0) {
+                policy.fsyncMode = FSYNC_ALWAYS;
+            } else if (strcmp(mode, "never") == 0) {
+                policy.fsyncMode = FSYNC_NEVER;
+            } else {
+                policy.fsyncMode     = FSYNC_PERIODIC;
+                policy.fsyncInterval = atoi(mode);
+            }
+        } else if (argv[i][0] != '-' && numPaths < MAX_FLEET_PATHS) {
+            /* Several files, or a directory, make a fleet of marinas */
+            if (!dataFile) dataFile = argv[i];
+            dataPaths[numPaths++] = argv[i];
+        } else {
+            dataFile = NULL;
+            break;
+        }
+    }
+    if (numBenchSizes > 0) {
+        return runBenchmark(benchSizes, numBenchSizes, loadThreads) == 0 ? 0 : 1;
+    }
+    if (dataFile && generateCount >= 0) {
+        return generateFleet(dataFile, generateCount, (uint64_t)generateCount) == 0 ? 0 : 1;
+    }
+    if (!dataFile) {
+        fprintf(stderr, "Usage: %s [--threads N] [--format csv|binary] "
+                        "[--import FILE.csv] [--export FILE.csv] [--journal] "
+                        "[--autosave SECS] [--fsync always|never|SECS] "
+                        "[--batch FILE|-] [--serve PATH|[HOST:]PORT] [--rates FILE] "
+                        "[--inventory [--filter SPEC] [--limit N] [--offset N]] "
+                        "[--generate N] [--stats] [--lazy] <BoatData.csv|BoatData.mbs>\n"
+                        "       %s [options] --batch FILE|-|--inventory <FILE|DIR>...\n"
+                        "       %s [--threads N] --bench [N,N,...]\n", argv[0], argv[0], argv[0]);
         return 1;
     }
+    DataFormat format = forceFormat >= 0 ? (DataFormat)forceFormat
+                                         : dataFormatForFile(dataFile);
 
     /* Prepare the BoatManager structure on the stack (no globals!). */
     BoatManager manager;
-    manager.numBoats = 0;
-    for (int i = 0; i < MAX_BOATS; i++) {
-        manager.boats[i] = NULL;
+    initBoatManager(&manager);
+
+    /* Billing rates: from the rate file if given, else the built-in ones */
+    RateSchedule rates = { NULL, 0 };
+    if (ratesFile && loadRateSchedule(&rates, ratesFile) != 0) {
+        return 1;
+    }
+    manager.rates = &rates;
+    manager.billThreads = loadThreads;
+
+    /* Latency statistics cost a clock read per measured call, so opt-in */
+    Stats stats;
+    if (wantStats) {
+        memset(&stats, 0, sizeof(stats));
+        manager.stats = &stats;
+    }
+
+    /* Several marinas: a shard each, driven by batch commands or listed */
+    struct stat pathStat;
+    if (numPaths > 1 || (stat(dataFile, &pathStat) == 0 && S_ISDIR(pathStat.st_mode))) {
+        int status = 1;
+        Fleet fleet;
+        initFleet(&fleet, threadsSet ? loadThreads : (int)sysconf(_SC_NPROCESSORS_ONLN));
+        if (importFile || exportFile || useJournal || serveAddress || (!batchFile && !listOnly)) {
+            fprintf(stderr, "A fleet of several marinas runs with --batch or --inventory only\n");
+            numPaths = 0;
+        }
+        for (int i = 0; i < numPaths && status != 0; i++) {
+            if (addFleetPath(&fleet, dataPaths[i], forceFormat) != 0) break;
+            status = i == numPaths - 1 ? 0 : 1;
+        }
+        for (int s = 0; s < fleet.numShards; s++) {
+            fleet.shards[s].rates = &rates;
+            fleet.shards[s].stats = manager.stats;
+        }
+        if (status == 0) status = loadFleetShards(&fleet) == 0 ? 0 : 1;
+
+        InventoryFilter filter;
+        OutBuffer out;
+        if (status == 0 && listOnly) {
+            status = 1;
+            if (parseListFilter(filterSpec, listLimit, listOffset, &filter) == 0 &&
+                outOpen(&out, STDOUT_FILENO) == 0) {
+                long rows = writeFleetInventory(&fleet, &out, &filter);
+                status = outClose(&out) == 0 && rows >= 0 ? 0 : 1;
+            }
+        } else if (status == 0) {
+            int failures = runFleetBatch(&fleet, batchFile);
+            saveFleetShards(&fleet, &policy);
+            status = failures == 0 ? 0 : 2;
+        }
+        if (manager.stats) printStats(&manager, stderr);
+        freeFleet(&fleet);
+        freeRateSchedule(&rates);
+        return status;
     }
 
-    /* Load data from CSV file, if exists */
-    loadFromCSV(&manager, argv[1]);
+    /* Load data from the data file (or the CSV being imported), if exists */
+    off_t journalValid = 0;
+    if (importFile) {
+        /* The imported fleet becomes the new snapshot straight away */
+        loadFleet(&manager, importFile, FORMAT_CSV, loadThreads);
+        if (saveFleet(&manager, dataFile, format, &policy) != 0) {
+            freeAllBoats(&manager);
+            freeRateSchedule(&rates);
+            return 1;
+        }
+    } else {
+        /* --lazy: index a CSV now and parse its boats as they are looked up;
+           a listing or a server needs them all anyway */
+        int lazy = lazyOpen && format == FORMAT_CSV && !listOnly && !serveAddress &&
+                   openLazyCSV(&manager, dataFile) == 0;
+        if (!lazy && loadFleet(&manager, dataFile, format, loadThreads) != 0) {
+            /* Refuse to run (and later overwrite) on a file we cannot read */
+            freeAllBoats(&manager);
+            freeRateSchedule(&rates);
+            return 1;
+        }
+        /* Re-apply changes logged since that snapshot was written */
+        journalValid = replayJournal(&manager, dataFile);
+    }
+    policy.lastSave = time(NULL);
+
+    /* Listing mode: write the (filtered) inventory to stdout and stop */
+    if (listOnly) {
+        InventoryFilter filter;
+        OutBuffer out;
+        int status = 1;
+        if (parseListFilter(filterSpec, listLimit, listOffset, &filter) == 0 &&
+            outOpen(&out, STDOUT_FILENO) == 0) {
+            writeInventory(&manager, &out, &filter);
+            status = outClose(&out) == 0 ? 0 : 1;
+        }
+        if (manager.stats) printStats(&manager, stderr);
+        freeAllBoats(&manager);
+        freeRateSchedule(&rates);
+        return status;
+    }
+
+    Journal journal;
+    if (useJournal) {
+        if (journalOpen(&journal, dataFile, &policy, journalValid) == 0) {
+            manager.journal = &journal;
+        } else {
+            fprintf(stderr, "Unable to open journal for '%s'\n", dataFile);
+        }
+    }
+
+    /* Batch mode: apply the command stream without prompts, then save */
+    if (batchFile) {
+        int failures = runBatch(&manager, batchFile);
+        saveAndClose(&manager, dataFile, format, &policy);
+        if (exportFile) {
+            loadRemainingBoats(&manager);
+            saveToCSV(&manager, exportFile);
+        }
+        if (manager.stats) printStats(&manager, stderr);
+        freeAllBoats(&manager);
+        freeRateSchedule(&rates);
+        return failures == 0 ? 0 : 2;
+    }
+
+    /* Server mode: one loaded fleet shared by every connected terminal */
+    if (serveAddress) {
+        int status = runServer(&manager, serveAddress, dataFile, format, &policy);
+        if (status == 0) {
+            saveAndClose(&manager, dataFile, format, &policy);
+            if (exportFile) saveToCSV(&manager, exportFile);
+            if (manager.stats) printStats(&manager, stderr);
+        } else if (manager.journal) {
+            journalClose(manager.journal);
+        }
+        freeAllBoats(&manager);
+        freeRateSchedule(&rates);
+        return status == 0 ? 0 : 1;
+    }
 
     /* Print welcome message */
     printf("\n");
@@ -593,8 +6967,9 @@ int main(int argc, char *argv[])
 
     /* Main menu loop */
     while (1) {
-        printf("(I)nventory, (A)dd, (R)emove, (P)ayment, (M)onth, e(X)it : ");
-        char cmd[32];
+        printf("(I)nventory, (A)dd, (R)emove, (P)ayment, (M)onth, (S)ummary, "
+               "(L)ocate, (F)ind, (O)wed, (T)imings, (B)ank file, e(X)it : ");
+        char cmd[MAX_NAME + 128];  /* room for an inventory filter */
         if (!fgets(cmd, sizeof(cmd), stdin)) {
             /* If EOF, break and save */
             break;
@@ -609,9 +6984,41 @@ int main(int argc, char *argv[])
 
         /* Convert first character to lowercase for case-insensitive menu */
         char c = (char)tolower((unsigned char)cmd[0]);
+        if (manager.lazy && strchr("islfo", c)) loadRemainingBoats(&manager);
         switch (c) {
-            case 'i':
-                printInventory(&manager);
+            case 'i': {
+                /* "i" lists everything; "i loc=slip,limit=20" filters */
+                InventoryFilter filter;
+                if (parseInventoryFilter(cmd + 1, cmd + strlen(cmd), &filter) != 0) {
+                    printf("Invalid inventory filter %s\n\n", cmd + 1);
+                    break;
+                }
+                printInventory(&manager, &filter);
+                break;
+            }
+            case 'o': {
+                /* "o" lists who owes what by location; "o top=100" the largest */
+                ReceivablesQuery query;
+                if (parseReceivablesQuery(cmd + 1, cmd + strlen(cmd), &query) != 0) {
+                    printf("Invalid receivables query %s\n\n", cmd + 1);
+                    break;
+                }
+                printReceivables(&manager, &query);
+                break;
+            }
+            case 's':
+                printSummary(&manager);
+                break;
+            case 't':
+                printStats(&manager, stdout);
+                break;
+            case 'l':
+                findLocation(&manager);
+                printf("\n");
+                break;
+            case 'f':
+                findByName(&manager);
+                printf("\n");
                 break;
             case 'a':
                 addBoat(&manager);
@@ -625,16 +7032,29 @@ int main(int argc, char *argv[])
                 acceptPayment(&manager);
                 printf("\n");
                 break;
+            case 'b':
+                importRemittance(&manager);
+                printf("\n");
+                break;
             case 'm':
-                monthlyUpdate(&manager);
+                /* "m" bills one month; "m 3" or "m 2025-01 2025-06" catch up */
+                if (billPeriodArgs(&manager, cmd + 1, cmd + strlen(cmd), NULL) != 0) {
+                    printf("Invalid billing period %s\n", cmd + 1);
+                }
                 printf("\n");
                 break;
             case 'x':
                 /* Exit the program: save CSV, free memory, then quit. */
                 printf("\nExiting the Boat Management System\n");
                 printf("\n");
-                saveToCSV(&manager, argv[1]);
+                saveAndClose(&manager, dataFile, format, &policy);
+                if (exportFile) {
+                    loadRemainingBoats(&manager);
+                    saveToCSV(&manager, exportFile);
+                }
+                if (manager.stats) printStats(&manager, stderr);
                 freeAllBoats(&manager);
+                freeRateSchedule(&rates);
                 return 0;
             default:
                 /* If invalid menu option, show error. */
@@ -642,11 +7062,19 @@ int main(int argc, char *argv[])
                 printf("\n");
                 break;
         }
+
+        autosaveIfDue(&manager, dataFile, format, &policy);
     }
 
     /* If we reach here, user likely did Ctrl+D or similar. Save and exit. */
-    saveToCSV(&manager, argv[1]);
+    saveAndClose(&manager, dataFile, format, &policy);
+    if (exportFile) {
+        loadRemainingBoats(&manager);
+        saveToCSV(&manager, exportFile);
+    }
+    if (manager.stats) printStats(&manager, stderr);
     freeAllBoats(&manager);
+    freeRateSchedule(&rates);
     return 0;
 }
 